@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include "core/perf.h"
+#include "bench.h"
+
+static thread_local uint64_t allocated_count = 0;
+static thread_local uint64_t allocated_bytes = 0;
+
+static void* _allocate(size_t size) {
+    allocated_count++;
+    allocated_bytes += size;
+    void* p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return _allocate(size); }
+void* operator new[](size_t size) { return _allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return _allocate(size); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return _allocate(size); } catch(...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+namespace bench {
+
+    struct Benchmark {
+        std::string         name;
+        Body                body;
+    };
+
+    static std::vector<Benchmark>& benchmarks() {
+        static std::vector<Benchmark> instance;
+        return instance;
+    }
+
+    Allocations allocations() {
+        Allocations ret;
+        ret.count = allocated_count;
+        ret.bytes = allocated_bytes;
+        return ret;
+    }
+
+    void add(const std::string& name, Body body) {
+        benchmarks().push_back({name, body});
+    }
+
+    struct Sample {
+        uint64_t            iterations;
+        double              ns;
+        Allocations         allocated;
+        perf::Reading       counters;           // over the whole run, when counting
+    };
+
+    static Sample _measure(const Body& body, uint64_t iterations) {
+        using namespace std::chrono;
+        Sample ret;
+        ret.iterations = iterations;
+        perf::Reading counters_before;
+        if(perf::enabled()) perf::read(&counters_before);
+        auto before = allocations();
+        auto t0 = steady_clock::now();
+        body(iterations);
+        auto t1 = steady_clock::now();
+        auto after = allocations();
+        if(counters_before.valid && perf::read(&ret.counters))
+            for(int e = 0; e < perf::EVENTS; e++) ret.counters.value[e] -= counters_before.value[e];
+        ret.ns = duration<double, std::nano>(t1 - t0).count();
+        ret.allocated.count = after.count - before.count;
+        ret.allocated.bytes = after.bytes - before.bytes;
+        return ret;
+    }
+
+    int run(int argc, char** argv) {
+        std::string filter;
+        double min_time_ns = 200e6;
+        bool csv = false;
+        bool counters = false;
+        for(int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if(arg == "--min-time" && i + 1 < argc) min_time_ns = atof(argv[++i]) * 1e6;
+            else if(arg == "--csv") csv = true;
+            else if(arg == "--perf") counters = true;
+            else if(!arg.empty() && arg[0] == '-') {
+                fprintf(stderr, "usage: %s [filter] [--min-time <ms>] [--csv] [--perf]\n", argv[0]);
+                return 1;
+            }
+            else filter = arg;
+        }
+
+        if(counters && !perf::enable(true)) fprintf(stderr, "no performance counter can be opened\n");
+        std::vector<perf::Event> events;       // the hardware ones this machine has
+        for(int e = perf::CYCLES; e < perf::EVENTS; e++)
+            if(perf::enabled() && perf::available((perf::Event) e)) events.push_back((perf::Event) e);
+
+        if(csv) printf("name,iterations,ns_per_op,allocs_per_op,bytes_per_op");
+        else printf("%-36s %12s %12s %10s %10s", "benchmark", "iterations", "ns/op", "allocs/op", "bytes/op");
+        for(auto e: events) printf(csv ? ",%s_per_op" : " %14s", (std::string(perf::event_name(e)) + "/op").c_str());
+        printf("\n");
+
+        for(auto&& b: benchmarks()) {
+            if(!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+
+            // one warm run, then grow the count until a run is a tenth of the target and scale it up from there
+            _measure(b.body, 1);
+            uint64_t n = 1;
+            Sample s = _measure(b.body, n);
+            while(s.ns < min_time_ns / 10 && n < (1ULL << 40)) {
+                n = s.ns > 0 ? std::max<uint64_t>(n * 2, (uint64_t) (n * (min_time_ns / 10) / s.ns)) : n * 100;
+                s = _measure(b.body, n);
+            }
+            if(s.ns < min_time_ns) s = _measure(b.body, (uint64_t) (n * min_time_ns / std::max(s.ns, 1.0)) + 1);
+
+            double ns = s.ns / s.iterations;
+            double allocs = (double) s.allocated.count / s.iterations;
+            double bytes = (double) s.allocated.bytes / s.iterations;
+            if(csv) printf("%s,%llu,%.2f,%.2f,%.1f", b.name.c_str(), (unsigned long long) s.iterations, ns, allocs,
+                           bytes);
+            else printf("%-36s %12llu %12.1f %10.2f %10.1f", b.name.c_str(), (unsigned long long) s.iterations,
+                        ns, allocs, bytes);
+            for(auto e: events) printf(csv ? ",%.2f" : " %14.1f", (double) s.counters.value[e] / s.iterations);
+            printf("\n");
+            fflush(stdout);
+        }
+        return 0;
+    }
+}
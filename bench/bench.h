@@ -0,0 +1,34 @@
+#ifndef QHM_BENCH_H
+#define QHM_BENCH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/* a minimal microbenchmark harness. A benchmark body runs its operation the number of times it is given; the
+ * harness grows that number until a run lasts long enough to be timed, then reports the time, the heap
+ * allocations and the bytes allocated per operation. Allocations are counted by replacing the global operator new,
+ * for the calling thread only, so background threads do not show up in the numbers. */
+namespace bench {
+
+    typedef std::function<void(uint64_t iterations)> Body;
+
+    struct Allocations {
+        uint64_t            count = 0;
+        uint64_t            bytes = 0;
+    };
+    Allocations             allocations();      // of this thread, since it started
+
+    void                    add(const std::string& name, Body body);
+
+    /* usage: <binary> [filter] [--min-time <ms>] [--csv] [--perf]; a filter runs only the names containing it,
+     * --perf adds the hardware counters per operation */
+    int                     run(int argc, char** argv);
+
+    /* keeps the compiler from dropping a result that is never read */
+    template <class T> inline void keep(T&& value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+}
+
+#endif //QHM_BENCH_H
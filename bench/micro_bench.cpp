@@ -0,0 +1,156 @@
+#include <memory>
+#include "base64/base64.h"
+#include "uuid/uuid.h"
+#include "messenger/messenger.h"
+#include "bench.h"
+
+static const QhmEndpoint client = {"127.0.10.15", 8015, "bench_client"};
+static const QhmEndpoint service = {"127.0.0.10", QHM_DEFAULT_SERVICE_PORT, "time_service"};
+
+/* what a worker receives: a request as message_from_type builds it, with a small json body */
+static std::string request_wire() {
+    auto msg = message_from_type(client, "/api/v1/time/imsi-23591000001?format=iso,unix&zone=utc", 0,
+                                 R"({"precision":"ms","client":"bench"})");
+    return std::string((const char*) msg.data(), msg.size());
+}
+
+static std::string response_wire() {
+    http::Response res;
+    res.status = 200;
+    res.headers[HEADER_KEY_SERVICE_SRC] = service.encoded();
+    res.headers[HEADER_KEY_PROCEDURE_ID] = "3f2a9c1e-5b7d-4e8f-a1c2-0d9e8f7a6b5c";
+    res.headers[HEADER_KEY_LOAD] = "12";
+    res.body = R"({"time":"2026-10-19T11:38:31.523Z","unix":1792409911523})";
+    return http::serialize(&res);
+}
+
+/* bodies capture what they work on, so that building it is not timed */
+static void http_benchmarks() {
+    auto request = request_wire();
+    auto response = response_wire();
+    auto parsed_request = std::make_shared<http::Request>(http::parse_request(request));
+    auto parsed_response = std::make_shared<http::Response>(http::parse_response(response));
+
+    bench::add("http/parse_request", [request](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto req = http::parse_request(request.data(), request.size());
+            bench::keep(req);
+        }
+    });
+    // what a worker does: parsed into a pooled message, freed once the reply is out
+    bench::add("http/parse_http_pooled", [request](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            http::Message* in = nullptr;
+            parse_http(request.data(), request.size(), &in);
+            bench::keep(in);
+            http::http_free(in);
+        }
+    });
+    bench::add("http/parse_response", [response](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto res = http::parse_response(response.data(), response.size());
+            bench::keep(res);
+        }
+    });
+    bench::add("http/serialize_request", [parsed_request](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto out = http::serialize(parsed_request.get());
+            bench::keep(out);
+        }
+    });
+    bench::add("http/serialize_response", [parsed_response](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto out = http::serialize(parsed_response.get());
+            bench::keep(out);
+        }
+    });
+}
+
+static Status _nop_handler(MessengerContext*, const nlohmann::json&, const http::Message*, http::Message**) {
+    return CORE_OK;
+}
+
+/* the routes of a service with many resources, all at the same depth: the url matches the last one added, which
+ * is the worst case for a linear scan */
+static void router_benchmarks() {
+    for(int size: {1, 10, 100, 1000}) {
+        auto router = std::make_shared<Router>();
+        for(int r = 0; r < size; r++)
+            router->add_route("/api/v1/resource" + std::to_string(r) + "/{id}", _nop_handler);
+        auto url = "/api/v1/resource" + std::to_string(size - 1) + "/imsi-23591000001?zone=utc";
+        bench::add("router/match/" + std::to_string(size), [router, url](uint64_t n) {
+            for(uint64_t i = 0; i < n; i++) {
+                auto route = router->match(url);
+                bench::keep(route);
+            }
+        });
+    }
+    auto schema = parse_param_ids_in_route("/nudm-sdm/v1/{supi}");
+    std::string params_url = "/nudm-sdm/v1/imsi-23591000001?dataset-names=name1,name2,name3&other-param=value";
+    bench::add("router/parse_all_params_in_url", [schema, params_url](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto params = parse_all_params_in_url(params_url, schema);
+            bench::keep(params);
+        }
+    });
+}
+
+static void codec_benchmarks() {
+    bench::add("endpoint/serialize_qhm_endpoint", [](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto wire = serialize_qhm_endpoint(service);
+            bench::keep(wire);
+        }
+    });
+    auto endpoint = serialize_qhm_endpoint(service);
+    bench::add("endpoint/parse_qhm_endpoint", [endpoint](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto node = parse_qhm_endpoint(endpoint);
+            bench::keep(node);
+        }
+    });
+    std::string peer = service.endpoint();
+    Interned::intern(peer);     // a known node: the lookup finds it
+    bench::add("endpoint/intern", [peer](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            SockEndpoint handle(peer);
+            bench::keep(handle);
+        }
+    });
+    std::string url = "/api/v1/time/imsi-23591000001?format=iso,unix&zone=utc";
+    bench::add("util/split", [url](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto tokens = split(url, '/');
+            bench::keep(tokens);
+        }
+    });
+    bench::add("util/generate_uuid", [](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto uuid = generate_uuid();
+            bench::keep(uuid);
+        }
+    });
+    std::string raw(64, '\x5a');
+    bench::add("util/base64_encode_64", [raw](uint64_t n) {
+        for(uint64_t i = 0; i < n; i++) {
+            auto encoded = macaron::Base64::Encode(raw);
+            bench::keep(encoded);
+        }
+    });
+    auto encoded = macaron::Base64::Encode(raw);
+    bench::add("util/base64_decode_64", [encoded](uint64_t n) {
+        std::string out;
+        for(uint64_t i = 0; i < n; i++) {
+            auto err = macaron::Base64::Decode(encoded, out);
+            bench::keep(err);
+            bench::keep(out);
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    http_benchmarks();
+    router_benchmarks();
+    codec_benchmarks();
+    return bench::run(argc, argv);
+}
@@ -29,5 +29,19 @@ struct Configuration {
 static const char*    CONFIG_KEY_SELF_IP     = "self_ip";
 static const char*    CONFIG_KEY_PORT        = "port";
 static const char*    CONFIG_KEY_TAG         = "tag";
+static const char*    CONFIG_KEY_EPHEMERAL_TTL = "ephemeral_peer_ttl_ms";
+static const char*    CONFIG_KEY_IDEMPOTENCY_TTL = "idempotency_ttl_ms";
+static const char*    CONFIG_KEY_IDEMPOTENCY_CAPACITY = "idempotency_capacity";
+static const char*    CONFIG_KEY_ADMISSION_QUEUE_DEPTH = "admission_queue_depth";
+static const char*    CONFIG_KEY_ADMISSION_QUEUE_DELAY = "admission_queue_delay_ms";
+static const char*    CONFIG_KEY_ADMISSION_RETRY_AFTER = "admission_retry_after_ms";
+static const char*    CONFIG_KEY_RESPONSE_CACHE_BYTES = "response_cache_bytes";
+static const char*    CONFIG_KEY_LOG_FILE    = "log_file";
+static const char*    CONFIG_KEY_VERBOSE_SAMPLE = "verbose_sample_every";
+static const char*    CONFIG_KEY_TRACE       = "trace";
+static const char*    CONFIG_KEY_CAPTURE_FILE = "capture_file";
+static const char*    CONFIG_KEY_FLIGHT_RECORDER = "flight_recorder_datagrams";
+static const char*    CONFIG_KEY_FLIGHT_RECORDER_DIR = "flight_recorder_dir";
+static const char*    CONFIG_KEY_PERF_COUNTERS = "perf_counters";
 
 #endif //NEWCORE_CONFIGURATION_H
@@ -5,42 +5,45 @@
 #ifndef QHM_EVENT_H
 #define QHM_EVENT_H
 
+#include <memory>
 #include "core/common.h"
+#include "core/intern.h"
 #include "http/http_types.h"
 
-class Event : public http::Request {
+/* what a worker queues for itself: the type, a name for the logs and, only when a handler needs them, parameters.
+ * Without parameters an event is three words, and it is moved through the queue, never copied. Names are few and
+ * fixed by the program, they are interned */
+class Event {
 public:
     Event() = default;
+    Event(const EventType& e): type(e), _name(&Interned::intern(app_msgtype_string(e)).str()) {}
+    Event(const EventType& e, const std::string& name): type(e), _name(&Interned::intern(name).str()) {}
 
-    Event(const http::Request& r) {
-        method = r.method;
-        path = r.path;
-        headers = r.headers;
-        body = r.body;
-        uri = r.uri;
-    }
+    Event(Event&&) = default;
+    Event& operator=(Event&&) = default;
 
-    Event(const EventType& e) {
-        method = HTTP_POST;
-        path = "/local/event";
-        headers[HEADER_KEY_EVENT_TYPE] = std::to_string(e);
-        headers[HEADER_KEY_EVENT_NAME] = app_msgtype_string(e);
+    /* allocated on first use: the handler of an event without parameters gets an empty object */
+    nlohmann::json& params() {
+        if(!_params) _params.reset(new nlohmann::json());
+        return *_params;
     }
-
-    Event(const EventType& e, const std::string& name) {
-        method = HTTP_POST;
-        path = "/local/event";
-        headers[HEADER_KEY_EVENT_TYPE] = std::to_string(e);
-        headers[HEADER_KEY_EVENT_NAME] = name;
+    const nlohmann::json& params() const {
+        static const nlohmann::json none;
+        return _params ? *_params : none;
     }
+    bool has_params() const { return (bool) _params; }
+    const std::string& name() const { return *_name; }
+
+    EventType                               type = (EventType) 0;
 
-    nlohmann::json  params;
-    std::string     callback_reference;
+private:
+    const std::string*                      _name = &Interned().str();     // an entry of the intern table
+    std::unique_ptr<nlohmann::json>         _params;
 };
 
 struct Procedure : public Event {
     Procedure():Event() {}
-    Procedure(const Event& e):Event(e) {}
+    Procedure(Event&& e):Event(std::move(e)) {}
     uint64_t                                id;
     http_status                             acknowledged;
     http::Request                           request;
@@ -6,11 +6,20 @@
 #define NEWCORE_MESSENGER_H
 
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <queue>
+#include <deque>
+#include <atomic>
+#include <memory>
 #include "udp/udp.h"
+#include "udp/capture.h"
 #include "http/parser.h"
 #include "core/common.h"
+#include "core/intern.h"
+#include "core/metrics.h"
+#include "core/perf.h"
+#include "core/trace.h"
 #include "event.h"
 #include "configuration.h"
 
@@ -19,22 +28,47 @@
 static const char*      MESSENGER_NODE_ENDPOINT = "endpoint";
 static const char*      MESSENGER_NODE_TAG = "tag";
 static const int        SOCKET_TIMEOUT = 3000;
+static const int        EPHEMERAL_PEER_TTL_MS = 30000;
+static const size_t     EPHEMERAL_PEER_CAPACITY = 1024;
+static const int        RELIABLE_INITIAL_RTO_MS = 20;
+static const int        RELIABLE_MIN_RTO_MS = 2;
+static const int        RELIABLE_MAX_RTO_MS = 1000;
+static const size_t     IDEMPOTENCY_CAPACITY = 4096;
+static const int        IDEMPOTENCY_TTL_MS = 10000;
+static const size_t     ADMISSION_QUEUE_DEPTH = 1024;
+static const int        ADMISSION_RETRY_AFTER_MS = 100;
+static const double     HEDGE_PERCENTILE = 0.95;
+static const size_t     HEDGE_LATENCY_SAMPLES = 128;
+static const size_t     HEDGE_MIN_SAMPLES = 16;
+static const double     HEDGE_BUDGET_RATIO = 0.1;
+static const double     HEDGE_BUDGET_BURST = 10;
+static const int        LOAD_HINT_TTL_MS = 1000;
+static const size_t     RESPONSE_CACHE_BYTES = 4 << 20;
+static const int        BREAKER_FAILURE_THRESHOLD = 5;
+static const int        BREAKER_OPEN_MS = 1000;
+static const int        BREAKER_HALF_OPEN_PROBES = 1;
+static const size_t     FLIGHT_RECORDER_DATAGRAMS = 1024;
+static const char*      FLIGHT_RECORDER_DIR = "/tmp";
+static const size_t     TRACE_EXPORT_MAX_BYTES = 64000;     // a /trace reply, headers included, fits a datagram
 
 /* forward declarations */
-struct      QhmEndpoint;
+class       QhmEndpoint;
 struct      NeighbourNode;
 struct      MessengerContext;
 struct      RouteParameter;
+struct      EphemeralPeer;
+struct      ServiceGroup;
 class       Messenger;
 
 /* typedefs */
 typedef     uint32_t ApplicationMessageType;
-typedef     std::string SockEndpoint;
-typedef     std::string NodeTag;
+typedef     Interned SockEndpoint;
+typedef     Interned NodeTag;
 typedef     std::string IpAddress;
 typedef     std::string UuidString;
 typedef     std::list<std::string> HttpHeaderSchema;
-typedef     std::map<NodeTag, NeighbourNode*> UriSocketMap;
+typedef     std::unordered_map<NodeTag, ServiceGroup> UriSocketMap;
+typedef     std::unordered_map<SockEndpoint, EphemeralPeer> EphemeralPeerMap;
 typedef     Status(* MessageHandler) (MessengerContext *,const http::Message *, http::Message **);
 typedef     Status(* RouteHandler)   (MessengerContext*, const nlohmann::json&, const http::Message *, http::Message **);
 typedef     Status(* EventHandler)   (MessengerContext*, const nlohmann::json& p);
@@ -52,24 +86,147 @@ typedef     std::vector<RouteParameter> RouteParams;
     Status _name (MessengerContext* _ctx, const nlohmann::json& _params, const http::Message* _in, http::Message** _out)
 
 
-struct QhmEndpoint {
+/* the encoding is derived from the other fields, hence they are only set through the constructors */
+class QhmEndpoint {
+public:
     QhmEndpoint() = default;
     QhmEndpoint(const IpAddress& ip, const int p, const NodeTag& uri);
-    int                                     port;
-    IpAddress                               ip_address;
-    NodeTag                                 tag;
-    SockEndpoint                            endpoint;
+    QhmEndpoint(const IpAddress& ip, const int p, const NodeTag& uri, const std::string& enc);
+
+    int port() const { return _port; }
+    const IpAddress& ip_address() const { return _ip_address; }
+    const NodeTag& tag() const { return _tag; }
+    const SockEndpoint& endpoint() const { return _endpoint; }
+    const std::string& encoded() const { return _encoded; }
+
+    /* swaps tag and endpoint for their entries of the intern table: same values, same encoding */
+    void intern();
+
+private:
+    int                                     _port = 0;
+    IpAddress                               _ip_address;
+    NodeTag                                 _tag;
+    SockEndpoint                            _endpoint;
+    std::string                             _encoded;   // compact wire form, computed once at construction
+};
+
+/* how busy a replica is known to be. Shared with the requests still waiting on it, which may outlive the node */
+struct NodeLoad {
+    std::atomic<int>                        outstanding{0};     // requests sent by tag, neither answered nor timed out
+    std::atomic<int>                        hint{0};            // application-load of its last reply
+    std::atomic<c_time_t>                   hint_expires{0};
 };
 
 struct NeighbourNode : public QhmEndpoint {
     NeighbourNode(const QhmEndpoint& n);
-    NeighbourNode(const QhmEndpoint& n, const std::string& src_ip);
-    ~NeighbourNode();
     Status                                  generate_request(http::Message**);
     Status                                  generate_response(http::Message**);
     bool                                    connected();
+    int                                     load() const;
+
+    QhmSockets::SockAddr                    address;    // resolved once, sends go through the worker socket
+    int                                     weight = 1;
+    std::shared_ptr<NodeLoad>               load_state = std::make_shared<NodeLoad>();
+};
+
+/* the replicas sharing a tag: callers address the tag, one of them is picked for each request */
+struct ServiceGroup {
+    NeighbourNode*                          pick() const;
+    NeighbourNode*                          find(const SockEndpoint& endpoint) const;
+
+    std::vector<NeighbourNode*>             members;
+};
+
+/* options for the outbound request helpers */
+struct RequestOptions {
+    bool                                    reliable = false;   // retransmit with an adaptive RTO until the deadline
+    const QhmEndpoint*                      hedge = nullptr;    // another replica, sent a duplicate if the first is slow
+    int                                     hedge_delay = 0;    // ms before hedging, 0 to wait for hedge_percentile
+    double                                  hedge_percentile = HEDGE_PERCENTILE;    // of the route's recent latency
+    bool                                    coalesce = false;   // identical concurrent GETs share one exchange
+};
+
+struct CachedReply {
+    std::string                             reply;      // serialized, ready to be sent
+    std::string                             dst;        // application-dst of the reply
+};
 
-    QhmSockets::Socket*                     socket = nullptr;
+/* replies to recent requests carrying a procedure id, keyed by (application-src, procid): a retried request is
+ * answered with the stored reply, without being parsed past its headers nor reaching its handler */
+struct IdempotencyCache {
+    struct Entry {
+        CachedReply                         reply;
+        c_time_t                            expires;
+    };
+
+    const CachedReply*                      find(const std::string& src, const std::string& procid);
+    void                                    store(const std::string& src, const std::string& procid,
+                                                  const CachedReply& reply);
+    bool                                    enabled() const { return capacity > 0; }
+
+    size_t                                  capacity = IDEMPOTENCY_CAPACITY;
+    c_time_t                                ttl = IDEMPOTENCY_TTL_MS * 1000;
+    std::unordered_map<std::string, Entry>  entries;
+    std::deque<std::pair<std::string, c_time_t>> order;     // insertion order, i.e. expiration order
+    uint64_t                                hits = 0;
+};
+
+/* a peer we reply to without knowing it (e.g. a sync_send_request caller) */
+struct EphemeralPeer {
+    QhmSockets::SockAddr                    address;
+    c_time_t                                expires;
+};
+
+/* a datagram taken off the socket, waiting for the worker */
+struct IngressMessage {
+    QhmSockets::Message                     message;
+    c_time_t                                received;
+    c_time_t                                deadline = 0;   // from its application-deadline, 0 if it has none
+};
+
+/* bounds on the work a worker accepts: requests beyond them are answered at once with a pre-serialized 503 */
+struct AdmissionControl {
+    size_t                                  queue_depth = ADMISSION_QUEUE_DEPTH;
+    c_time_t                                queue_delay = 0;        // longest wait before handling, 0 for no bound
+    int                                     retry_after = ADMISSION_RETRY_AFTER_MS;
+    std::string                             rejection;              // serialized 503 without application-dst
+    uint64_t                                shed = 0;
+    uint64_t                                expired = 0;    // dropped because their caller gave up
+};
+
+/* pre-serialized responses of the cacheable routes; the least recently used go once they exceed capacity bytes */
+struct ResponseCache {
+    struct Entry {
+        std::string                         reply;      // without application-dst, procid and load
+        c_time_t                            expires;
+        std::list<std::string>::iterator    lru;
+    };
+
+    const std::string*                      find(const std::string& key);
+    void                                    store(const std::string& key, const std::string& reply, c_time_t ttl);
+
+    size_t                                  capacity = RESPONSE_CACHE_BYTES;
+    size_t                                  size = 0;
+    std::unordered_map<std::string, Entry>  entries;
+    std::list<std::string>                  lru;        // most recently used first
+    uint64_t                                hits = 0;
+    uint64_t                                misses = 0;
+};
+
+/* opt-in caching of the 200 responses to GETs on a route, keyed on the normalized path and the listed values */
+struct RouteCachePolicy {
+    c_time_t                                ttl = 0;        // usec, 0 for no caching
+    std::vector<std::string>                query_params;
+    std::vector<std::string>                headers;
+    bool                                    enabled() const { return ttl > 0; }
+};
+
+/* the series of a route or message type in the metrics registry, looked up once */
+struct TransactionMetrics {
+    metrics::Counter*                       transactions = nullptr;
+    metrics::Counter*                       errors = nullptr;       // failed handlers and 5xx replies
+    metrics::Histogram*                     latency = nullptr;      // usec, from arrival to reply
+    std::string                             label;                  // the route or message type
 };
 
 struct RouteParameter {
@@ -82,22 +239,45 @@ struct Route {
     RouteHandler                            handler;
     size_t                                  depth;
     RouteParams                             params;
+    RouteCachePolicy                        cache;
+    std::string                             path;
+    TransactionMetrics                      metrics;
 };
 
 class Router {
 public:
     Route*                                  match(const std::string& url);
-    void                                    add_route(const std::string& route, RouteHandler handler);
+    void                                    add_route(const std::string& route, RouteHandler handler,
+                                                      const RouteCachePolicy& cache = RouteCachePolicy());
     std::vector<Route>                      routes;
 };
 
 struct MessengerContext {
     bool                                    should_run;
     UriSocketMap                            known_nodes;
+    EphemeralPeerMap                        ephemeral_peers;
+    std::deque<std::pair<SockEndpoint, c_time_t>> ephemeral_order;  // insertion order, i.e. expiration order
+    c_time_t                                ephemeral_peer_ttl = EPHEMERAL_PEER_TTL_MS * 1000;
+    IdempotencyCache                        idempotency;
+    AdmissionControl                        admission;
+    ResponseCache                           response_cache;
+    std::deque<IngressMessage>              ingress;
+    std::map<ApplicationMessageType, TransactionMetrics> message_metrics;
+    TransactionMetrics                      unrouted_metrics;
+    TransactionMetrics                      replayed_metrics;   // answered from the idempotency cache
+    metrics::Gauge*                         queue_depth = nullptr;
+    metrics::Gauge*                         in_flight = nullptr;
     QhmEndpoint *                           node_self;
+    QhmSockets::Socket *                    socket = nullptr;
     std::queue<Event>                       event_queue;
     Router                                  router;
     bool                                    verbose = false;
+    LogSampler                              dump_sampler;       // which verbose messages are printed in full
+    std::unique_ptr<QhmSockets::CaptureWriter> capture;         // every datagram received, when configured
+    QhmSockets::FlightRecorder              flight_recorder { FLIGHT_RECORDER_DATAGRAMS };
+    std::string                             flight_recorder_dir = FLIGHT_RECORDER_DIR;
+    unsigned                                flight_recorder_dumps = 0;  // dump requests already served
+    QhmSockets::SockAddr                    self_address;       // what captured datagrams were sent to
     UuidString                              uuid;
 };
 
@@ -128,43 +308,97 @@ private:
     Status                                  process_message(const QhmSockets::Message &udp_message_in,
                                                             QhmSockets::Message *udp_message_out, QhmEndpoint *dest);
     Status                                  process_event();
-    Status                                  process_http(http::Message* in, http::Message** out);
+    bool                                    receive();
+    bool                                    admit(IngressMessage& ingress);
+    void                                    shed(const IngressMessage& ingress);
+    void                                    observe(const QhmSockets::Message& message);
+    void                                    dump_flight_recorder();
+    Status                                  process_http(http::Message* in, Route* route, http::Message** out);
 
     QhmSockets::Socket *                    rtr_socket = nullptr;
+    TransactionMetrics *                    served = nullptr;   // what the message being processed is accounted to
     ApplicationMsgHandlersMap               app_msg_handlers;
     EventHandlersMap                        evt_handlers;
 };
 
 DECLARE_MESSAGE_HANDLER(default_handler, req, rep, ctx);
 DECLARE_MESSAGE_HANDLER(terminate_handler, req, rep, ctx);
+DECLARE_ROUTE_HANDLER(metrics_handler, req, rep, params, ctx);
 
 QhmSockets::Message         message_from_type(const QhmEndpoint& src, const std::string& url,uint32_t type = 0,
                                               const std::string& body = "", http_method m = HTTP_GET);
-void                        dispatch_event(MessengerContext *ctx, const Event &evt);
+void                        dispatch_event(MessengerContext *ctx, Event evt);
 bool                        validate_http_message(const http::Message *msg, const HttpHeaderSchema &schema);
 Status                      transaction_commit(MessengerContext* context, const QhmSockets::Message &reply,
-                                               const QhmEndpoint& dest);
+                                               const QhmEndpoint& dest,
+                                               const QhmSockets::SockAddr* source = nullptr);
+const QhmSockets::SockAddr* ephemeral_peer_address(MessengerContext* context, const QhmEndpoint& peer);
 Status                      error(MessengerContext* context, QhmSockets::Message *resp,
-                                  const NodeTag& dest, uint32_t status);
+                                  const QhmEndpoint& dest, uint32_t status);
 NeighbourNode*              find_node_by_uri(const NodeTag &uri, const UriSocketMap * nodes,
                                              NeighbourNode **dest);
+TransactionMetrics          transaction_metrics(const NodeTag& service, const std::string& key,
+                                                const std::string& value);
 Status                      parse_http(const void *src, size_t len, http::Message **);
 QhmEndpoint                 parse_url(const std::string&);
 std::string                 parse_path(const std::string& url_string);
 QhmEndpoint                 parse_qhm_endpoint(const std::string &);
 std::string                 serialize_qhm_endpoint(const QhmEndpoint &);
+std::string                 encode_qhm_endpoint(const QhmEndpoint &);
 QhmEndpoint                 qhm_endpoint_from_configuration(const Configuration& c);
-NeighbourNode*              add_node(MessengerContext*,const QhmEndpoint &);
+NeighbourNode*              add_node(MessengerContext*,const QhmEndpoint &, int weight = 1);
 Status                      del_node(MessengerContext*,const QhmEndpoint &);
 nlohmann::json              parse_params_in_token (const std::string &token);
 nlohmann::json              parse_all_params_in_url(const std::string &url, const RouteParams &params_schema);
 std::string                 generate_route_regex (const std::string &route);
+std::string                 response_cache_key(const http::Request* request, const RouteCachePolicy& policy);
 RouteParams                 parse_param_ids_in_route (const std::string& url);
 void                        generate_response(const http::Message *in, http::Message **out, http_status status);
 http::Response              sync_send_request(http::Request *request, const QhmEndpoint &host,
-                                              const QhmEndpoint &dest_node, int timeout = 300);
+                                              const QhmEndpoint &dest_node, int timeout = 300,
+                                              const RequestOptions& options = RequestOptions());
+http::Response              sync_send_request(MessengerContext* context, http::Request *request, const NodeTag& tag,
+                                              int timeout = 300, const RequestOptions& options = RequestOptions());
 void                        async_send_request(http::Request *request, const QhmEndpoint &host,
                                                const QhmEndpoint &dest_node, int timeout = 300);
+void                        async_send_request(MessengerContext* context, http::Request *request,
+                                               const NodeTag& tag, int timeout = 300);
+std::string                 next_procedure_id();
+c_time_t                    request_deadline();
+void                        set_request_deadline(c_time_t deadline);
+int                         peer_rto(const SockEndpoint& peer);
+void                        peer_rtt_sample(const SockEndpoint& peer, c_time_t rtt);
+int                         route_latency_percentile(const std::string& route, double percentile);
+void                        route_latency_sample(const std::string& route, c_time_t latency);
+bool                        breaker_allow(const SockEndpoint& peer);
+void                        breaker_record(const SockEndpoint& peer, bool success);
+void                        breaker_release(const SockEndpoint& peer);
+bool                        breaker_open(const SockEndpoint& peer);
+void                        hedge_budget_deposit();
+bool                        hedge_budget_take();
+int                         _random_endpoint(QhmSockets::Socket& socket, const std::string& ip,
+                                             std::string& local_endpoint);
+unsigned                    install_flight_recorder_signal();   // SIGUSR2 has every worker dump its recorder,
+                                                                // returns the requests made so far
+void                        request_flight_recorder_dump();
+
+/* feeds a capture to a service with the original spacing between datagrams, divided by speed (0 for no spacing).
+ * Service terminations in the capture are not replayed */
+struct ReplayOptions {
+    double                                  speed = 1;
+    std::string                             reply_ip;       // when set, replies are asked here and counted
+    int                                     linger = 1000;  // ms to wait for the last replies
+};
+
+struct ReplayResult {
+    size_t                                  sent = 0;
+    size_t                                  skipped = 0;
+    size_t                                  replies = 0;
+    c_time_t                                elapsed = 0;
+};
+
+ReplayResult                replay_capture(const std::string& path, const SockEndpoint& target,
+                                           const ReplayOptions& options = ReplayOptions());
 
 /* http headers schemas */
 
@@ -187,7 +421,7 @@ static inline bool              headers_have(const headers_map& hdrs, const std:
 inline static size_t            url_depth(const std::string& url) { return split(url, '/').size(); }
 
 inline static http::Response*   reply_back(const http::Message* m) {
-    auto r = new http::Response();
+    auto r = http::new_response();
     r->headers[HEADER_KEY_SERVICE_DST] = m->headers.at(HEADER_KEY_SERVICE_SRC);
     return r;
 }
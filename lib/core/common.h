@@ -54,6 +54,10 @@ static inline std::string app_msgtype_string(uint32_t type) {
     fun(9,    HEADER_KEY_SERVICE_SRC,       "application-src") \
     fun(10,   HEADER_KEY_SERVICE_DST,       "application-dst") \
     fun(11,   HEADER_KEY_PROCEDURE_ID,      "application-procid") \
+    fun(12,   HEADER_KEY_RETRY_AFTER,       "application-retry-after") \
+    fun(13,   HEADER_KEY_LOAD,              "application-load") \
+    fun(14,   HEADER_KEY_DEADLINE,          "application-deadline") \
+    fun(15,   HEADER_KEY_TRACE,             "application-trace") \
 
 //enum HTTP_HEADER_KEY : uint64_t {
 //#define CHOOSE_NUM(num, name, str) ENUM_##name = num,
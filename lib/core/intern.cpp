@@ -0,0 +1,95 @@
+#include <mutex>
+#include <unordered_set>
+#include "intern.h"
+
+static const size_t SHARDS = 64;
+
+/* never destroyed: handles held by statics must outlive it. Elements of an unordered_set keep their address across
+ * rehashing, which is what makes them usable as handles */
+struct InternTable {
+    struct Shard {
+        std::mutex                      lock;
+        std::unordered_set<std::string> values;
+    };
+    Shard                               shards[SHARDS];
+    const std::string*                  empty = &*shards[std::hash<std::string>()("") % SHARDS].values.insert("").first;
+};
+
+static InternTable& table() {
+    static InternTable* instance = new InternTable();
+    return *instance;
+}
+
+static const std::string* find(const std::string& value, size_t hash, bool insert) {
+    auto& t = table();
+    if(value.empty()) return t.empty;
+    auto& shard = t.shards[hash % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if(insert) return &*shard.values.insert(value).first;
+    auto it = shard.values.find(value);
+    return it != shard.values.end() ? &*it : nullptr;
+}
+
+Interned::Interned(): value(table().empty), _hash(std::hash<std::string>()("")) {}
+
+Interned::Interned(const std::string* entry, size_t hash): value(entry), _hash(hash) {}
+
+Interned::Interned(const std::string& v): _hash(std::hash<std::string>()(v)) {
+    value = find(v, _hash, false);
+    if(value) return;
+    own = v;
+    value = &own;
+}
+
+Interned::Interned(std::string&& v): _hash(std::hash<std::string>()(v)) {
+    value = find(v, _hash, false);
+    if(value) return;
+    own = std::move(v);
+    value = &own;
+}
+
+Interned::Interned(const char* v): Interned(std::string(v)) {}
+
+Interned::Interned(const Interned& other): _hash(other._hash) {
+    if(other.interned()) { value = other.value; return; }
+    own = other.own;
+    value = &own;
+}
+
+Interned& Interned::operator=(const Interned& other) {
+    if(this == &other) return *this;
+    _hash = other._hash;
+    if(other.interned()) { value = other.value; own.clear(); return *this; }
+    own = other.own;
+    value = &own;
+    return *this;
+}
+
+Interned::Interned(Interned&& other): _hash(other._hash) {
+    if(other.interned()) { value = other.value; return; }
+    own = std::move(other.own);
+    value = &own;
+}
+
+Interned& Interned::operator=(Interned&& other) {
+    if(this == &other) return *this;
+    _hash = other._hash;
+    if(other.interned()) { value = other.value; own.clear(); return *this; }
+    own = std::move(other.own);
+    value = &own;
+    return *this;
+}
+
+Interned Interned::intern(const std::string& v) {
+    size_t hash = std::hash<std::string>()(v);
+    return Interned(find(v, hash, true), hash);
+}
+
+size_t Interned::table_size() {
+    size_t size = 0;
+    for(auto& shard: table().shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        size += shard.values.size();
+    }
+    return size;
+}
@@ -0,0 +1,64 @@
+#ifndef NEWCORE_INTERN_H
+#define NEWCORE_INTERN_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+/* a string, and its hash, computed once. Values the process keeps for long (configured and known nodes) are put in
+ * a process wide table with intern(): handles to them share the table's entry, copying one copies a pointer and two
+ * of them are equal exactly when the pointers are. Any other value, typically read off the network, is looked up
+ * and, when absent, kept by the handle as a plain string: nothing a peer sends makes the table grow. Lookups lock
+ * one of a number of shards, picked by the hash. */
+class Interned {
+public:
+    Interned();                                     // the empty string
+    Interned(const std::string& value);             // shares the table's entry if there is one
+    Interned(const char* value);
+    Interned(std::string&& value);
+    Interned(const Interned& other);
+    Interned(Interned&& other);
+    Interned& operator=(const Interned& other);
+    Interned& operator=(Interned&& other);
+
+    static Interned         intern(const std::string& value);   // adds it to the table
+    static size_t           table_size();
+
+    bool                    interned() const { return value != &own; }
+    const std::string&      str() const { return *value; }
+    operator const std::string&() const { return *value; }
+    const char*             c_str() const { return value->c_str(); }
+    const char*             data() const { return value->data(); }
+    size_t                  size() const { return value->size(); }
+    bool                    empty() const { return value->empty(); }
+    size_t                  hash() const { return _hash; }
+
+    bool                    operator==(const Interned& other) const {
+        if(value == other.value) return true;
+        if(interned() && other.interned()) return false;
+        return _hash == other._hash && *value == *other.value;
+    }
+    bool                    operator!=(const Interned& other) const { return !(*this == other); }
+    bool                    operator<(const Interned& other) const { return *value < *other.value; }
+
+private:
+    Interned(const std::string* entry, size_t hash);
+
+    const std::string*      value;                  // the table's entry, or own
+    size_t                  _hash;
+    std::string             own;
+};
+
+inline std::ostream& operator<<(std::ostream& o, const Interned& i) { return o << i.str(); }
+inline std::string operator+(const Interned& i, const std::string& s) { return i.str() + s; }
+inline std::string operator+(const std::string& s, const Interned& i) { return s + i.str(); }
+inline std::string operator+(const Interned& i, const char* s) { return i.str() + s; }
+inline std::string operator+(const char* s, const Interned& i) { return s + i.str(); }
+
+namespace std {
+    template <> struct hash<Interned> {
+        size_t operator()(const Interned& i) const { return i.hash(); }
+    };
+}
+
+#endif //NEWCORE_INTERN_H
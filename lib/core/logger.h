@@ -15,6 +15,15 @@ typedef int64_t c_time_t;
 
 c_time_t time_now(void);
 std::string time_string();
+const char* time_cstring();     // same as time_string, in a per-thread buffer reformatted once per millisecond
+
+/* lines are handed to a background writer through a ring owned by the calling thread, so logging never waits on
+ * the terminal or the disk. When the writer falls behind and a ring fills up the line is dropped and counted. An
+ * abort, a failed assert() among them, drains the rings before the process goes. */
+void        log_write(const std::string& line);
+bool        log_to_file(const std::string& path);   // empty path goes back to stdout
+void        log_flush();                            // returns once every line written before the call is out
+uint64_t    log_dropped();
 
 static const std::string ANSI_COLOR_RED   =  "\x1b[31m";
 static const std::string ANSI_COLOR_GREEN  = "\x1b[32m";
@@ -27,8 +36,6 @@ static const std::string STYLE_WARN     =    "\x1b[33m\x1b[1m";
 static const std::string STYLE_ERR      =    "\x1b[31m\x1b[1m";
 static const std::string STYLE_OK        =   "\x1b[34m";
 
-static char logline_buffer[16384];
-
 #define stringy(arg) #arg
 
 
@@ -38,32 +45,72 @@ public:
     Logger(const std::string& s, const std::string& t):style(&s),logtag(t) {}
     std::ostream& operator<<(const std::string& st){ s << st; return s; }
     ~Logger() {
-        if(style)  std::cout << *style;
-        std::cout << "[" << time_string() << "] ";
-        if(!logtag.empty()) std::cout << "[" << logtag << "] ";
-        std::cout << s.str();
-        if(style) std::cout << ANSI_COLOR_RESET;
-        std::cout << std::endl;
+        std::string line;
+        if(style) line += *style;
+        line += "[";
+        line += time_cstring();
+        line += "] ";
+        if(!logtag.empty()) line += "[" + logtag + "] ";
+        line += s.str();
+        if(style) line += ANSI_COLOR_RESET;
+        line += "\n";
+        log_write(line);
     }
 private:
     const std::string* style = nullptr;
     const std::string logtag;
-    std::stringstream s;
+    std::ostringstream s;
+};
+
+/* levels below CORE_LOG_LEVEL are compiled out: the statement is still type checked but its branch is constant
+ * false, so neither the Logger nor anything streamed into it is ever built. Pick it with the QHM_LOG_LEVEL cmake
+ * option. */
+#define CORE_LOG_LEVEL_TRACE    0
+#define CORE_LOG_LEVEL_DEBUG    1
+#define CORE_LOG_LEVEL_INFO     2
+#define CORE_LOG_LEVEL_WARN     3
+#define CORE_LOG_LEVEL_ERR      4
+#define CORE_LOG_LEVEL_NONE     5
+
+#ifndef CORE_LOG_LEVEL
+#define CORE_LOG_LEVEL          CORE_LOG_LEVEL_TRACE
+#endif
+
+/* turns the stream a log statement ends with into void, so that both branches of core_at_level have the same type.
+ * & binds looser than << and tighter than ?:, the whole statement stays one expression: no dangling else after an
+ * unbraced if */
+struct LogVoidify {
+    void operator&(std::ostream&) {}
+    void operator&(const Logger&) {}
 };
 
-#define core_log              Logger(ANSI_COLOR_RESET)
-#define core_ok               Logger(STYLE_OK)
-#define core_err              Logger(STYLE_ERR)
-#define core_warn             Logger(STYLE_WARN)
+#define core_at_level(level)  ((level) < CORE_LOG_LEVEL) ? (void) 0 : LogVoidify() &
 
-#define core_log_tag(arg)     Logger(ANSI_COLOR_RESET, arg)
-#define core_ok_tag(arg)      Logger(STYLE_OK, arg)
-#define core_err_tag(arg)     Logger(STYLE_ERR, arg)
-#define core_warn_tag(arg)    Logger(STYLE_WARN, arg)
+#define core_trace            core_at_level(CORE_LOG_LEVEL_TRACE) Logger(ANSI_COLOR_RESET)
+#define core_debug            core_at_level(CORE_LOG_LEVEL_DEBUG) Logger(ANSI_COLOR_RESET)
+#define core_log              core_at_level(CORE_LOG_LEVEL_INFO) Logger(ANSI_COLOR_RESET)
+#define core_ok               core_at_level(CORE_LOG_LEVEL_INFO) Logger(STYLE_OK)
+#define core_warn             core_at_level(CORE_LOG_LEVEL_WARN) Logger(STYLE_WARN)
+#define core_err              core_at_level(CORE_LOG_LEVEL_ERR) Logger(STYLE_ERR)
 
+#define core_trace_tag(arg)   core_at_level(CORE_LOG_LEVEL_TRACE) Logger(ANSI_COLOR_RESET, arg)
+#define core_debug_tag(arg)   core_at_level(CORE_LOG_LEVEL_DEBUG) Logger(ANSI_COLOR_RESET, arg)
+#define core_log_tag(arg)     core_at_level(CORE_LOG_LEVEL_INFO) Logger(ANSI_COLOR_RESET, arg)
+#define core_ok_tag(arg)      core_at_level(CORE_LOG_LEVEL_INFO) Logger(STYLE_OK, arg)
+#define core_warn_tag(arg)    core_at_level(CORE_LOG_LEVEL_WARN) Logger(STYLE_WARN, arg)
+#define core_err_tag(arg)     core_at_level(CORE_LOG_LEVEL_ERR) Logger(STYLE_ERR, arg)
+
+/* lets one in every `every` calls through, for dumps too costly to print for each message. Not thread safe: keep
+ * one per thread, or per worker. 0 lets nothing through. */
+struct LogSampler {
+    explicit LogSampler(uint64_t every = 1): every(every) {}
+    bool                sample() { return every && seen++ % every == 0; }
+    uint64_t            every;
+    uint64_t            seen = 0;
+};
 
 #define core_assert(cond, expr) \
-if ( ! ( cond ) )   \
+if ( __builtin_expect( ! ( cond ), 0 ) )   \
  { core_err << "assert fail:\t! ( " << #cond << " )   [" << __FILE__ << ":" << __LINE__ << "]" ; expr; }
 
 #define core_try(expr, failure) \
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "logger.h"
+
+static const size_t LOG_RING_BYTES = 1 << 18;          // per thread, a power of two
+static const int    LOG_IDLE_WAIT_MS = 1000;          // the writer is woken when there is work, this is a backstop
+static const int    LOG_ABORT_WAIT_MS = 100;          // for the writer to finish its pass before an abort drains
+
+/* single producer (the owning thread), single consumer (the writer). Positions only grow, the index into data is
+ * taken modulo the size; every line is stored as its length followed by its bytes */
+struct LogRing {
+    LogRing(): head(0), tail(0), retired(false) {}
+
+    bool push(const char* line, uint32_t len) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if(sizeof(len) + len > LOG_RING_BYTES - (h - t)) return false;
+        copy_in(h, (const char*) &len, sizeof(len));
+        copy_in(h + sizeof(len), line, len);
+        head.store(h + sizeof(len) + len, std::memory_order_release);
+        return true;
+    }
+
+    bool drain(FILE* out) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if(t == h) return false;
+        while(t != h) {
+            uint32_t len;
+            copy_out(t, (char*) &len, sizeof(len));
+            size_t off = (t + sizeof(len)) & (LOG_RING_BYTES - 1);
+            size_t first = std::min((size_t) len, LOG_RING_BYTES - off);
+            fwrite(data + off, 1, first, out);
+            if(first < len) fwrite(data, 1, len - first, out);
+            t += sizeof(len) + len;
+        }
+        tail.store(t, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    void copy_in(size_t pos, const char* src, size_t len) {
+        size_t off = pos & (LOG_RING_BYTES - 1);
+        size_t first = std::min(len, LOG_RING_BYTES - off);
+        memcpy(data + off, src, first);
+        memcpy(data, src + first, len - first);
+    }
+
+    void copy_out(size_t pos, char* dst, size_t len) const {
+        size_t off = pos & (LOG_RING_BYTES - 1);
+        size_t first = std::min(len, LOG_RING_BYTES - off);
+        memcpy(dst, data + off, first);
+        memcpy(dst + first, data, len - first);
+    }
+
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool>   retired;        // the owner exited, the writer frees the ring once it is empty
+    char                data[LOG_RING_BYTES];
+};
+
+static std::atomic<bool> sink_down(false);
+
+class LogSink;
+static std::atomic<LogSink*> aborting_sink(nullptr);
+static void _on_abort(int sig);
+
+class LogSink {
+public:
+    LogSink(): writer(&LogSink::run, this) {
+        // a failed assert or an abort takes the queued lines out with it, the error that led there among them.
+        // Installed only over the default disposition: an application handler wins
+        aborting_sink = this;
+        struct sigaction current;
+        if(sigaction(SIGABRT, nullptr, &current) != 0 || current.sa_handler != SIG_DFL) return;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &_on_abort;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGABRT, &action, nullptr);
+    }
+
+    ~LogSink() {
+        // from here on lines go straight out, unordered with the ones still queued but not lost
+        sink_down = true;
+        aborting_sink = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if(out != stdout) fclose(out);
+        // rings of threads still alive are left alone, they may be mid push
+    }
+
+    LogRing* ring() {
+        LogRing* r = new LogRing();
+        std::lock_guard<std::mutex> guard(lock);
+        rings.push_back(r);
+        return r;
+    }
+
+    bool redirect(const std::string& path) {
+        FILE* next = stdout;
+        if(!path.empty()) {
+            next = fopen(path.c_str(), "a");
+            if(!next) return false;
+        }
+        std::lock_guard<std::mutex> guard(output_lock);
+        if(out != stdout) fclose(out);
+        out = next;
+        return true;
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> guard(lock);
+        uint64_t ticket = ++flush_requested;
+        wake.notify_one();
+        flushed.wait(guard, [&] { return flush_done >= ticket || stopping; });
+    }
+
+    /* from the owner of a ring that was empty: the writer may be asleep */
+    void wake_writer() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queued = true;
+        }
+        wake.notify_one();
+    }
+
+    /* the process is going down: whatever the rings hold goes out from the aborting thread. Neither the writer nor
+     * the locks are waited on for long, the thread that aborted may be the one holding them */
+    void drain_on_abort() {
+        bool locked = false;
+        for(int i = 0; i < LOG_ABORT_WAIT_MS && !(locked = output_lock.try_lock()); i++) usleep(1000);
+        for(auto r: rings) r->drain(out);
+        fflush(out);
+        if(locked) output_lock.unlock();
+    }
+
+    std::atomic<uint64_t>   dropped {0};
+
+private:
+    void run() {
+        uint64_t reported = 0;
+        while(true) {
+            std::vector<LogRing*> pending;
+            uint64_t ticket;
+            bool stop;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending = rings;
+                ticket = flush_requested;
+                stop = stopping;
+                queued = false;
+            }
+
+            std::vector<LogRing*> finished;
+            {
+                std::lock_guard<std::mutex> guard(output_lock);
+                bool wrote = false;
+                for(auto r: pending) {
+                    // read before draining: a retired ring gets no more lines after this
+                    bool retired = r->retired.load(std::memory_order_acquire);
+                    wrote |= r->drain(out);
+                    if(retired) finished.push_back(r);
+                }
+                uint64_t d = dropped.load(std::memory_order_relaxed);
+                if(d != reported) {
+                    fprintf(out, "%s[%s] [logger] %llu lines dropped%s\n", STYLE_WARN.c_str(), time_cstring(),
+                            (unsigned long long) (d - reported), ANSI_COLOR_RESET.c_str());
+                    reported = d;
+                    wrote = true;
+                }
+                if(wrote) fflush(out);
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            for(auto r: finished) {
+                rings.erase(std::find(rings.begin(), rings.end(), r));
+                delete r;
+            }
+            flush_done = ticket;
+            flushed.notify_all();
+            if(stop) return;
+            // a ring refilled while it was drained had no reason to wake anyone
+            wake.wait_for(guard, std::chrono::milliseconds(LOG_IDLE_WAIT_MS), [&] {
+                return stopping || flush_requested != flush_done || queued
+                       || std::any_of(rings.begin(), rings.end(), [](const LogRing* r) { return !r->empty(); });
+            });
+        }
+    }
+
+    std::mutex              lock;               // rings, flush and stop requests
+    std::mutex              output_lock;        // out, held by the writer for a whole pass
+    std::condition_variable wake;
+    std::condition_variable flushed;
+    std::vector<LogRing*>   rings;
+    uint64_t                flush_requested = 0;
+    uint64_t                flush_done = 0;
+    bool                    stopping = false;
+    bool                    queued = false;         // lines went into an empty ring
+    FILE*                   out = stdout;
+    std::thread             writer;             // last, it starts running in the constructor
+};
+
+static LogSink& sink() {
+    static LogSink instance;
+    return instance;
+}
+
+static void _on_abort(int sig) {
+    LogSink* s = aborting_sink.load();
+    if(s) s->drain_on_abort();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+struct RingOwner {
+    ~RingOwner() { if(ring) ring->retired.store(true, std::memory_order_release); }
+    LogRing* ring = nullptr;
+};
+
+void log_write(const std::string& line) {
+    // once the sink is shutting down at exit there is nobody left to drain
+    if(sink_down) {
+        fwrite(line.data(), 1, line.size(), stdout);
+        return;
+    }
+    static thread_local RingOwner owner;
+    LogSink& s = sink();
+    if(!owner.ring) owner.ring = s.ring();
+    bool was_empty = owner.ring->empty();
+    if(line.size() > LOG_RING_BYTES / 2 || !owner.ring->push(line.data(), (uint32_t) line.size()))
+        s.dropped.fetch_add(1, std::memory_order_relaxed);
+    else if(was_empty)
+        s.wake_writer();
+}
+
+bool log_to_file(const std::string& path) {
+    return sink().redirect(path);
+}
+
+void log_flush() {
+    if(sink_down) return;
+    sink().flush();
+}
+
+uint64_t log_dropped() {
+    return sink().dropped.load(std::memory_order_relaxed);
+}
@@ -8,8 +8,7 @@
 #include <sys/time.h>
 #include "logger.h"
 
-#define TIME_FMT_STR    "%02d/%02d %02d:%02d:%02d.%03d"
-#define TIME_STR_LEN    19
+#define TIME_STR_LEN    19                          // "MM/DD hh:mm:ss.mmm" and its terminator
 
 #define USEC_PER_SEC uint64_t(1000000)
 
@@ -78,14 +77,35 @@ static void explode_time(time_exp_t *xt, c_time_t t, int use_localtime) {
     xt->tm_gmtoff = 0;
 }
 
-std::string time_string() {
+/* value in width decimal digits, zero padded, at `at`. No terminator */
+static inline void _digits(char* at, int value, int width) {
+    for(int i = width - 1; i >= 0; i--, value /= 10) at[i] = (char) ('0' + value % 10);
+}
+
+const char* time_cstring() {
+    // log lines come in bursts: the date is only exploded when the second changes, the millis when the milli does.
+    // Digits are written in place, every field having a known width: no format to overflow the buffer
+    static thread_local c_time_t cached_sec = -1, cached_msec = -1;
+    static thread_local char cached[TIME_STR_LEN] = "00/00 00:00:00.000";
 
-    time_exp_t te;
-    explode_time(&te, time_now(), 1);
+    c_time_t now = time_now();
+    if(now / 1000 == cached_msec) return cached;
+    cached_msec = now / 1000;
+    c_time_t sec = now / (c_time_t) USEC_PER_SEC;
+    if(sec != cached_sec) {
+        cached_sec = sec;
+        time_exp_t te;
+        explode_time(&te, now, 1);
+        _digits(cached, te.tm_mon + 1, 2);
+        _digits(cached + 3, te.tm_mday, 2);
+        _digits(cached + 6, te.tm_hour, 2);
+        _digits(cached + 9, te.tm_min, 2);
+        _digits(cached + 12, te.tm_sec, 2);
+    }
+    _digits(cached + TIME_STR_LEN - 4, (int) (cached_msec % 1000), 3);
+    return cached;
+}
 
-    char temp[TIME_STR_LEN];
-    sprintf(temp, TIME_FMT_STR,
-            te.tm_mon + 1, te.tm_mday, te.tm_hour,
-            te.tm_min, te.tm_sec, te.tm_usec / 1000);
-    return std::string(temp);
-}
\ No newline at end of file
+std::string time_string() {
+    return std::string(time_cstring());
+}
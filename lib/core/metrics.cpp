@@ -0,0 +1,191 @@
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include "metrics.h"
+
+namespace metrics {
+
+    void* CacheAligned::operator new(size_t size) {
+        void* p = nullptr;
+        if(posix_memalign(&p, CACHE_LINE, size) != 0) throw std::bad_alloc();
+        return p;
+    }
+
+    void CacheAligned::operator delete(void *p) {
+        free(p);
+    }
+
+    Counter::Counter() {
+        for(auto& slot: slots) slot.value.store(0, std::memory_order_relaxed);
+    }
+
+    int64_t Counter::value() const {
+        int64_t total = 0;
+        for(auto& slot: slots) total += slot.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    struct Histogram::Shard : public CacheAligned {
+        Shard() {
+            for(auto& b: buckets) b.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+        }
+        std::atomic<uint64_t>   buckets[HISTOGRAM_BUCKETS];
+        std::atomic<int64_t>    sum;
+    };
+
+    Histogram::Histogram() {
+        for(auto& s: shards) s.store(nullptr, std::memory_order_relaxed);
+    }
+
+    Histogram::~Histogram() {
+        for(auto& s: shards) delete s.load(std::memory_order_relaxed);
+    }
+
+    Histogram::Shard* Histogram::shard() {
+        auto& slot = shards[thread_slot()];
+        Shard* s = slot.load(std::memory_order_acquire);
+        if(s) return s;
+        // first sample from this slot: whoever installs a shard first wins
+        Shard* fresh = new Shard();
+        if(slot.compare_exchange_strong(s, fresh, std::memory_order_acq_rel)) return fresh;
+        delete fresh;
+        return s;
+    }
+
+    void Histogram::record(int64_t value) {
+        if(value < 0) value = 0;
+        Shard* s = shard();
+        s->buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        s->sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    size_t Histogram::bucket(int64_t value) {
+        const int64_t sub = 1 << HISTOGRAM_SUB_BITS;
+        if(value < sub) return (size_t) value;
+        int msb = 63 - __builtin_clzll((unsigned long long) value);
+        if(msb > HISTOGRAM_MAX_BITS) return HISTOGRAM_BUCKETS - 1;
+        int64_t top = value >> (msb - HISTOGRAM_SUB_BITS);
+        return (size_t) ((msb - HISTOGRAM_SUB_BITS + 1) * sub + (top - sub));
+    }
+
+    int64_t Histogram::bucket_upper_bound(size_t bucket) {
+        const int64_t sub = 1 << HISTOGRAM_SUB_BITS;
+        if(bucket < (size_t) sub) return (int64_t) bucket + 1;
+        int64_t group = bucket / sub, offset = bucket % sub;
+        return (sub + offset + 1) << (group - 1);
+    }
+
+    HistogramSnapshot Histogram::snapshot() const {
+        HistogramSnapshot snap;
+        snap.buckets.assign(HISTOGRAM_BUCKETS, 0);
+        for(auto& slot: shards) {
+            Shard* s = slot.load(std::memory_order_acquire);
+            if(!s) continue;
+            for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+                snap.buckets[i] += s->buckets[i].load(std::memory_order_relaxed);
+            snap.sum += s->sum.load(std::memory_order_relaxed);
+        }
+        for(auto b: snap.buckets) snap.count += b;
+        return snap;
+    }
+
+    int64_t HistogramSnapshot::percentile(double p) const {
+        if(count == 0) return 0;
+        uint64_t rank = (uint64_t) (p * count);
+        if(rank >= count) rank = count - 1;
+        uint64_t seen = 0;
+        for(size_t i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if(seen > rank) return Histogram::bucket_upper_bound(i);
+        }
+        return Histogram::bucket_upper_bound(buckets.size() - 1);
+    }
+
+    template<typename M>
+    static M* _series(std::map<std::string, std::map<std::string, std::unique_ptr<M>>>& families,
+                      const std::string& name, const std::string& labels) {
+        auto& series = families[name][labels];
+        if(!series) series.reset(new M());
+        return series.get();
+    }
+
+    Counter* Registry::counter(const std::string &name, const std::string &labels) {
+        std::lock_guard<std::mutex> guard(lock);
+        return _series(counters, name, labels);
+    }
+
+    Gauge* Registry::gauge(const std::string &name, const std::string &labels) {
+        std::lock_guard<std::mutex> guard(lock);
+        return _series(gauges, name, labels);
+    }
+
+    Histogram* Registry::histogram(const std::string &name, const std::string &labels) {
+        std::lock_guard<std::mutex> guard(lock);
+        return _series(histograms, name, labels);
+    }
+
+    static std::string _labelled(const std::string& name, const std::string& labels, const std::string& extra = "") {
+        std::string all = labels;
+        if(!extra.empty()) all += (all.empty() ? "" : ",") + extra;
+        return all.empty() ? name : name + "{" + all + "}";
+    }
+
+    std::string Registry::prometheus() const {
+        std::lock_guard<std::mutex> guard(lock);
+        std::ostringstream out;
+
+        for(auto&& family: counters) {
+            out << "# TYPE " << family.first << " counter\n";
+            for(auto&& series: family.second)
+                out << _labelled(family.first, series.first) << " " << series.second->value() << "\n";
+        }
+        for(auto&& family: gauges) {
+            out << "# TYPE " << family.first << " gauge\n";
+            for(auto&& series: family.second)
+                out << _labelled(family.first, series.first) << " " << series.second->value() << "\n";
+        }
+        // cumulative buckets at each power of two, all of them whatever was recorded, so that the series never change.
+        // le is inclusive where the bucket bounds are not: the values being integers, it is the bound less one. The
+        // last bucket, where larger values land, is only +Inf
+        for(auto&& family: histograms) {
+            out << "# TYPE " << family.first << " histogram\n";
+            for(auto&& series: family.second) {
+                auto snap = series.second->snapshot();
+                const size_t sub = 1 << HISTOGRAM_SUB_BITS;
+                uint64_t cumulative = 0;
+                for(size_t i = 0; i < snap.buckets.size() - 1; i++) {
+                    cumulative += snap.buckets[i];
+                    if((i + 1) % sub == 0)
+                        out << _labelled(family.first + "_bucket", series.first,
+                                         "le=\"" + std::to_string(Histogram::bucket_upper_bound(i) - 1) + "\"")
+                            << " " << cumulative << "\n";
+                }
+                out << _labelled(family.first + "_bucket", series.first, "le=\"+Inf\"") << " " << snap.count << "\n";
+                out << _labelled(family.first + "_sum", series.first) << " " << snap.sum << "\n";
+                out << _labelled(family.first + "_count", series.first) << " " << snap.count << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    std::string labels(const std::vector<std::pair<std::string, std::string>>& pairs) {
+        std::string ret;
+        for(auto&& pair: pairs) {
+            if(!ret.empty()) ret += ",";
+            ret += pair.first + "=\"";
+            for(char c: pair.second) {
+                if(c == '\\' || c == '"') ret += '\\';
+                if(c == '\n') { ret += "\\n"; continue; }
+                ret += c;
+            }
+            ret += "\"";
+        }
+        return ret;
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef NEWCORE_METRICS_H
+#define NEWCORE_METRICS_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* process-wide metrics. Writers only touch the slot of their own thread (padded to a cache line, so threads never
+ * share one), readers merge the slots when they look. Series are looked up by name and labels once, the pointers
+ * stay valid for the life of the process and are what the hot path uses. */
+namespace metrics {
+
+    static const size_t     CACHE_LINE = 64;
+    static const size_t     MAX_THREADS = 64;                   // threads beyond these share slots
+    static const int        HISTOGRAM_SUB_BITS = 4;             // 16 linear buckets per power of two, ~6% error
+    static const int        HISTOGRAM_MAX_BITS = 40;            // larger values land in the last bucket
+    static const size_t     HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) << HISTOGRAM_SUB_BITS;
+
+    inline size_t thread_slot() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t slot = next++ % MAX_THREADS;
+        return slot;
+    }
+
+    /* cache line aligned allocation, which plain new does not give before C++17 */
+    struct CacheAligned {
+        static void*        operator new(size_t size);
+        static void         operator delete(void* p);
+    };
+
+    struct Slot {
+        std::atomic<int64_t>    value;
+        char                    padding[CACHE_LINE - sizeof(std::atomic<int64_t>)];
+    };
+
+    class Counter : public CacheAligned {
+    public:
+        Counter();
+        void                inc(int64_t n = 1) { slots[thread_slot()].value.fetch_add(n, std::memory_order_relaxed); }
+        int64_t             value() const;
+    private:
+        Slot                slots[MAX_THREADS];
+    };
+
+    class Gauge : public CacheAligned {
+    public:
+        Gauge() { slot.value.store(0, std::memory_order_relaxed); }
+        void                set(int64_t v) { slot.value.store(v, std::memory_order_relaxed); }
+        void                add(int64_t n) { slot.value.fetch_add(n, std::memory_order_relaxed); }
+        int64_t             value() const { return slot.value.load(std::memory_order_relaxed); }
+    private:
+        Slot                slot;
+    };
+
+    struct HistogramSnapshot {
+        std::vector<uint64_t>   buckets;
+        uint64_t                count = 0;
+        int64_t                 sum = 0;
+        int64_t                 percentile(double p) const;     // upper bound of the bucket holding it
+    };
+
+    /* log-linear buckets as in HdrHistogram: values below 16 are exact, above that each power of two is split in 16 */
+    class Histogram : public CacheAligned {
+    public:
+        Histogram();
+        ~Histogram();
+        void                record(int64_t value);
+        HistogramSnapshot   snapshot() const;
+
+        static size_t       bucket(int64_t value);
+        static int64_t      bucket_upper_bound(size_t bucket);     // exclusive
+    private:
+        struct Shard;
+        Shard*              shard();
+        std::atomic<Shard*> shards[MAX_THREADS];
+    };
+
+    class Registry {
+    public:
+        Counter*            counter(const std::string& name, const std::string& labels = "");
+        Gauge*              gauge(const std::string& name, const std::string& labels = "");
+        Histogram*          histogram(const std::string& name, const std::string& labels = "");
+        std::string         prometheus() const;     // text exposition format
+
+    private:
+        template<typename M>
+        using Families = std::map<std::string, std::map<std::string, std::unique_ptr<M>>>;
+
+        mutable std::mutex  lock;
+        Families<Counter>   counters;
+        Families<Gauge>     gauges;
+        Families<Histogram> histograms;
+    };
+
+    Registry&               registry();
+    std::string             labels(const std::vector<std::pair<std::string, std::string>>& pairs);
+}
+
+#endif //NEWCORE_METRICS_H
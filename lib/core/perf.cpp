@@ -0,0 +1,208 @@
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf.h"
+
+namespace perf {
+
+    std::atomic<bool> on(false);
+
+    static const size_t MAX_PENDING = 64;       // stages of one transaction, the rest is not noted
+
+    struct EventSpec {
+        uint32_t            type;
+        uint64_t            config;
+        const char*         name;
+    };
+
+    static const EventSpec specs[EVENTS] = {
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,      "task_clock_ns"},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,      "cycles"},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,    "instructions"},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                 | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),   "l1d_misses"},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,    "llc_misses"},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,   "branch_misses"},
+    };
+
+    // hardware events first: a group led by a software event can take them, but not every kernel moves it
+    static const Event open_order[EVENTS] = { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES,
+                                              TASK_CLOCK };
+
+    const char* event_name(Event event) {
+        return event < EVENTS ? specs[event].name : "";
+    }
+
+    struct Totals {
+        uint64_t            count = 0;
+        uint64_t            sum[EVENTS] = {0};
+    };
+    typedef std::map<std::pair<std::string, std::string>, Totals> Table;     // by label and stage
+
+    /* one per thread, only its thread adds to it: the lock is for the reader */
+    struct Aggregate {
+        std::mutex          lock;
+        Table               table;
+    };
+
+    /* never destroyed, like the aggregates: threads still committing at exit must find them */
+    struct Registry {
+        std::mutex                  lock;
+        std::vector<Aggregate*>     aggregates;
+        std::atomic<unsigned>       opened {0};    // a bit per event some thread could open
+    };
+
+    static Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    struct ThreadState {
+        ThreadState() { for(int e = 0; e < EVENTS; e++) { fds[e] = -1; index[e] = -1; } }
+        ~ThreadState() { for(int e = 0; e < EVENTS; e++) if(fds[e] >= 0) close(fds[e]); }
+        bool                tried = false;
+        int                 leader = -1;
+        int                 fds[EVENTS];
+        int                 index[EVENTS];          // position in what a read of the group returns
+        int                 members = 0;
+        Aggregate*          aggregate = nullptr;
+        std::vector<std::pair<const char*, Reading>> pending;
+    };
+    static thread_local ThreadState state;
+
+    static bool _open() {
+        if(state.tried) return state.leader >= 0;
+        state.tried = true;
+        for(auto e: open_order) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = specs[e].type;
+            attr.config = specs[e].config;
+            attr.disabled = state.leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, state.leader, 0);
+            if(fd < 0) continue;
+            if(state.leader < 0) state.leader = fd;
+            state.fds[e] = fd;
+            state.index[e] = state.members++;
+            registry().opened.fetch_or(1u << e, std::memory_order_relaxed);
+        }
+        if(state.leader < 0) return false;
+        ioctl(state.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(state.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        state.pending.reserve(MAX_PENDING);
+        return true;
+    }
+
+    bool enable(bool enabled) {
+        on.store(enabled, std::memory_order_relaxed);
+        return !enabled || _open();
+    }
+
+    bool available(Event event) {
+        return event < EVENTS && _open() && state.fds[event] >= 0;
+    }
+
+    bool read(Reading* out) {
+        out->valid = false;
+        if(!_open()) return false;
+        uint64_t values[1 + EVENTS];
+        auto wanted = (ssize_t) ((1 + state.members) * sizeof(uint64_t));
+        if(::read(state.leader, values, sizeof(values)) < wanted) return false;
+        for(int e = 0; e < EVENTS; e++) out->value[e] = state.index[e] < 0 ? 0 : values[1 + state.index[e]];
+        out->valid = true;
+        return true;
+    }
+
+    Stage::Stage(const char* name): name(name) {
+        if(enabled()) read(&begin);
+    }
+
+    Stage::~Stage() {
+        if(!begin.valid) return;
+        Reading end;
+        if(!read(&end) || state.pending.size() >= MAX_PENDING) return;
+        for(int e = 0; e < EVENTS; e++) end.value[e] -= begin.value[e];
+        state.pending.emplace_back(name, end);
+    }
+
+    void commit(const std::string& label) {
+        if(state.pending.empty()) return;
+        if(!state.aggregate) {
+            state.aggregate = new Aggregate();
+            std::lock_guard<std::mutex> guard(registry().lock);
+            registry().aggregates.push_back(state.aggregate);
+        }
+        {
+            std::lock_guard<std::mutex> guard(state.aggregate->lock);
+            for(auto&& stage: state.pending) {
+                auto& totals = state.aggregate->table[std::make_pair(label, std::string(stage.first))];
+                totals.count++;
+                for(int e = 0; e < EVENTS; e++) totals.sum[e] += stage.second.value[e];
+            }
+        }
+        state.pending.clear();
+    }
+
+    std::string report() {
+        Table merged;
+        {
+            auto& r = registry();
+            std::lock_guard<std::mutex> guard(r.lock);
+            for(auto a: r.aggregates) {
+                std::lock_guard<std::mutex> a_guard(a->lock);
+                for(auto&& row: a->table) {
+                    auto& totals = merged[row.first];
+                    totals.count += row.second.count;
+                    for(int e = 0; e < EVENTS; e++) totals.sum[e] += row.second.sum[e];
+                }
+            }
+        }
+        unsigned opened = registry().opened.load(std::memory_order_relaxed);
+
+        std::ostringstream out;
+        out << std::left << std::setw(32) << "label" << std::setw(20) << "stage" << std::right << std::setw(10)
+            << "count";
+        for(int e = 0; e < EVENTS; e++) out << " " << std::setw(17) << (std::string(specs[e].name) + "/op");
+        out << " " << std::setw(7) << "ipc" << "\n";
+        out.setf(std::ios::fixed);
+        out.precision(1);
+        for(auto&& row: merged) {
+            auto& t = row.second;
+            out << std::left << std::setw(32) << (row.first.first.empty() ? "-" : row.first.first)
+                << std::setw(20) << row.first.second << std::right << std::setw(10) << t.count;
+            for(int e = 0; e < EVENTS; e++) {
+                out << " " << std::setw(17);
+                if(opened & (1u << e)) out << (double) t.sum[e] / t.count;
+                else out << "n/a";
+            }
+            out << " " << std::setw(7);
+            if((opened & (1u << CYCLES)) && (opened & (1u << INSTRUCTIONS)) && t.sum[CYCLES])
+                out << std::setprecision(2) << (double) t.sum[INSTRUCTIONS] / t.sum[CYCLES]
+                    << std::setprecision(1);
+            else out << "n/a";
+            out << "\n";
+        }
+        if(merged.empty()) out << (opened ? "no stage measured yet\n" : "no performance counter available\n");
+        return out.str();
+    }
+
+    void clear() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        for(auto a: r.aggregates) {
+            std::lock_guard<std::mutex> a_guard(a->lock);
+            a->table.clear();
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef NEWCORE_PERF_H
+#define NEWCORE_PERF_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* hardware performance counters around the stages of a transaction, to tell why a stage is slow and not only that
+ * it is. Each thread opens its own perf_event_open group the first time it measures and reads every counter with a
+ * single read(). A stage only notes the difference between its two readings; commit() files the stages measured
+ * since the previous commit under a label (the route, typically), and report() sums them per label and stage.
+ * Counters the kernel or the machine does not offer (virtual machines often have no PMU, perf_event_paranoid may
+ * forbid them) are left out and reported as such; task-clock is a software event and nearly always there.
+ * When the mode is off a stage costs a relaxed load. */
+namespace perf {
+
+    enum Event {
+        TASK_CLOCK,             // ns on cpu
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,             // read misses
+        LLC_MISSES,
+        BRANCH_MISSES,
+        EVENTS
+    };
+    const char*             event_name(Event event);
+
+    struct Reading {
+        uint64_t            value[EVENTS] = {0};
+        bool                valid = false;
+    };
+
+    extern std::atomic<bool> on;
+    inline bool             enabled() { return on.load(std::memory_order_relaxed); }
+    bool                    enable(bool enabled);   // false when not a single counter can be opened
+    bool                    available(Event event); // on this thread
+    bool                    read(Reading* out);     // this thread's counters, now
+
+    class Stage {
+    public:
+        explicit Stage(const char* name);           // a literal, only the pointer is kept
+        ~Stage();
+        Stage(const Stage&) = delete;
+        Stage& operator=(const Stage&) = delete;
+
+    private:
+        const char*         name;
+        Reading             begin;
+    };
+
+    void                    commit(const std::string& label);
+    std::string             report();               // a table, a row per label and stage
+    void                    clear();
+}
+
+#endif //NEWCORE_PERF_H
@@ -0,0 +1,44 @@
+#ifndef NEWCORE_POOL_H
+#define NEWCORE_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+/* a free list per thread. Released objects go back to the list of the thread releasing them, whichever acquired
+ * them, and the next acquire on that thread takes the most recent one: its strings and containers still have the
+ * capacity they grew to, so steady traffic stops reaching malloc. Objects come back as they were released, resetting
+ * them is up to the caller. Past Capacity free objects a release deletes. */
+template <typename T, size_t Capacity = 64>
+class Pool {
+public:
+    static T* acquire() {
+        auto& items = free_list().items;
+        if(items.empty()) return new T();
+        T* t = items.back();
+        items.pop_back();
+        return t;
+    }
+
+    static void release(T* t) {
+        if(!t) return;
+        auto& items = free_list().items;
+        if(items.size() >= Capacity) { delete t; return; }
+        items.push_back(t);
+    }
+
+    static size_t free_count() { return free_list().items.size(); }     // on this thread
+
+private:
+    struct FreeList {
+        FreeList() { items.reserve(Capacity); }
+        ~FreeList() { for(auto t: items) delete t; }
+        std::vector<T*>     items;
+    };
+
+    static FreeList& free_list() {
+        static thread_local FreeList list;
+        return list;
+    }
+};
+
+#endif //NEWCORE_POOL_H
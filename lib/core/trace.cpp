@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "logger.h"
+#include "trace.h"
+
+namespace trace {
+
+    std::atomic<bool> on(false);
+
+    uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    struct Record {
+        const char*         name;
+        uint64_t            begin;
+        uint64_t            end;
+        Context             self;
+        uint64_t            parent;
+        uint32_t            tid;
+    };
+
+    /* written by one thread at a time; the reader trusts what the counter says is complete and not overwritten */
+    struct Buffer {
+        Record                  records[BUFFER_SPANS];
+        std::atomic<uint64_t>   written {0};
+        std::atomic<uint64_t>   cleared {0};
+    };
+
+    /* never destroyed: threads still closing spans at exit must find it */
+    struct Registry {
+        std::mutex                          lock;
+        std::vector<Buffer*>                buffers;        // every buffer handed out
+        std::vector<Buffer*>                spare;          // of the threads that exited, for the next ones
+        std::map<uint32_t, std::string>     thread_names;
+    };
+
+    static Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    /* ticks are converted against a steady clock sampled at load time and at export, and placed on the wall clock
+     * so that traces of different processes line up */
+    struct Origin {
+        uint64_t                                ticks;
+        std::chrono::steady_clock::time_point   steady;
+        c_time_t                                wall;
+    };
+    static const Origin origin = { ticks(), std::chrono::steady_clock::now(), time_now() };
+
+    struct ThreadState {
+        ~ThreadState() {
+            if(!buffer) return;
+            std::lock_guard<std::mutex> guard(registry().lock);
+            registry().spare.push_back(buffer);
+        }
+        Buffer*             buffer = nullptr;
+        Context             current;
+        uint32_t            tid = 0;
+        uint64_t            seed = 0;
+    };
+    static thread_local ThreadState state;
+
+    static uint32_t _tid() {
+        if(!state.tid) state.tid = (uint32_t) syscall(SYS_gettid);
+        return state.tid;
+    }
+
+    /* splitmix64, seeded once per thread */
+    static uint64_t _next_id() {
+        if(!state.seed) {
+            std::random_device rd;
+            state.seed = ((uint64_t) rd() << 32 | rd()) ^ ticks();
+        }
+        uint64_t z = (state.seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return z ? z : 1;
+    }
+
+    static Buffer* _buffer() {
+        if(state.buffer) return state.buffer;
+        auto& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        if(!r.spare.empty()) {
+            state.buffer = r.spare.back();
+            r.spare.pop_back();
+        } else {
+            state.buffer = new Buffer();
+            r.buffers.push_back(state.buffer);
+        }
+        return state.buffer;
+    }
+
+    void enable(bool enabled) {
+        on.store(enabled, std::memory_order_relaxed);
+    }
+
+    Context current() {
+        return state.current;
+    }
+
+    static std::string _hex(uint64_t v) {
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) v);
+        return std::string(buf, 16);
+    }
+
+    std::string header() {
+        if(!state.current.valid()) return "";
+        return _hex(state.current.trace_id) + ":" + _hex(state.current.span_id);
+    }
+
+    Context parse(const std::string& header) {
+        Context ctx;
+        auto colon = header.find(':');
+        if(colon == std::string::npos) return ctx;
+        char* end = nullptr;
+        uint64_t trace_id = strtoull(header.c_str(), &end, 16);
+        if(end != header.c_str() + colon) return ctx;
+        uint64_t span_id = strtoull(header.c_str() + colon + 1, &end, 16);
+        if(*end != '\0') return ctx;
+        ctx.trace_id = trace_id;
+        ctx.span_id = span_id;
+        return ctx;
+    }
+
+    void name_thread(const std::string& name) {
+        auto tid = _tid();
+        std::lock_guard<std::mutex> guard(registry().lock);
+        registry().thread_names[tid] = name;
+    }
+
+    Span::Span(const char* name): name(name) {
+        if(enabled()) open(state.current);
+    }
+
+    Span::Span(const char* name, const Context& parent): name(name) {
+        if(enabled()) open(parent.valid() ? parent : state.current);
+    }
+
+    void Span::open(const Context& from) {
+        active = true;
+        previous = state.current;
+        parent = from;
+        self.trace_id = from.valid() ? from.trace_id : _next_id();
+        self.span_id = _next_id();
+        state.current = self;
+        begin = ticks();
+    }
+
+    Span::~Span() {
+        if(!active) return;
+        uint64_t end = ticks();
+        Buffer* b = _buffer();
+        uint64_t n = b->written.load(std::memory_order_relaxed);
+        b->records[n % BUFFER_SPANS] = { name, begin, end, self, parent.span_id, _tid() };
+        b->written.store(n + 1, std::memory_order_release);
+        state.current = previous;
+    }
+
+    static std::string _escaped(const std::string& s) {
+        std::string ret;
+        for(char c: s) {
+            if(c == '"' || c == '\\') ret += '\\';
+            if((unsigned char) c < 0x20) continue;
+            ret += c;
+        }
+        return ret;
+    }
+
+    std::string chrome_json(size_t max_spans, size_t max_bytes) {
+        std::vector<Record> records;
+        std::map<uint32_t, std::string> names;
+        {
+            auto& r = registry();
+            std::lock_guard<std::mutex> guard(r.lock);
+            for(auto b: r.buffers) {
+                uint64_t n = b->written.load(std::memory_order_acquire);
+                uint64_t first = std::max(b->cleared.load(std::memory_order_relaxed),
+                                          n > BUFFER_SPANS ? n - BUFFER_SPANS : 0);
+                size_t copied = records.size();
+                for(uint64_t i = first; i < n; i++) records.push_back(b->records[i % BUFFER_SPANS]);
+                // slots the owner reused while they were copied are not trusted
+                uint64_t after = b->written.load(std::memory_order_acquire);
+                if(after + 1 > first + BUFFER_SPANS) {
+                    uint64_t stale = std::min(after + 1 - BUFFER_SPANS - first, n - first);
+                    records.erase(records.begin() + copied, records.begin() + copied + stale);
+                }
+            }
+            names = r.thread_names;
+        }
+
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                                                                   - origin.steady).count();
+        uint64_t now = ticks();
+        double ticks_per_us = (elapsed > 0 && now > origin.ticks) ? (now - origin.ticks) / elapsed : 1;
+        auto at = [&](uint64_t t) { return origin.wall + (double) (int64_t) (t - origin.ticks) / ticks_per_us; };
+
+        // the most recent spans are those asked for, the bounds drop the oldest
+        std::sort(records.begin(), records.end(), [](const Record& l, const Record& r) { return l.end < r.end; });
+        size_t kept = max_spans ? std::min(max_spans, records.size()) : records.size();
+
+        std::unordered_map<uint64_t, const Record*> by_span;
+        for(auto& rec: records) by_span[rec.self.span_id] = &rec;
+
+        auto pid = getpid();
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        auto sep = [&]() { if(!first) out << ",\n"; first = false; };
+
+        for(auto&& name: names) {
+            sep();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << name.first
+                << ",\"args\":{\"name\":\"" << _escaped(name.second) << "\"}}";
+        }
+
+        // newest first, until the byte bound, then written oldest first
+        std::vector<std::string> events;
+        size_t size = (size_t) out.tellp() + 2;
+        for(size_t i = records.size(); i > records.size() - kept; i--) {
+            auto& rec = records[i - 1];
+            std::ostringstream event;
+            event.setf(std::ios::fixed);
+            event.precision(3);
+            event << "{\"name\":\"" << rec.name << "\",\"cat\":\"qhm\",\"ph\":\"X\",\"ts\":" << at(rec.begin)
+                  << ",\"dur\":" << (double) (rec.end - rec.begin) / ticks_per_us
+                  << ",\"pid\":" << pid << ",\"tid\":" << rec.tid
+                  << ",\"args\":{\"trace\":\"" << _hex(rec.self.trace_id) << "\",\"span\":\""
+                  << _hex(rec.self.span_id) << "\",\"parent\":\"" << _hex(rec.parent) << "\"}}";
+
+            // an arrow from the parent when it ran on another thread, typically the caller of a request
+            auto parent = by_span.find(rec.parent);
+            if(parent != by_span.end() && parent->second->tid != rec.tid)
+                event << ",\n{\"name\":\"request\",\"cat\":\"qhm\",\"ph\":\"s\",\"id\":\"0x"
+                      << _hex(rec.self.span_id) << "\",\"ts\":" << at(rec.begin) << ",\"pid\":" << pid
+                      << ",\"tid\":" << parent->second->tid << "}"
+                      << ",\n{\"name\":\"request\",\"cat\":\"qhm\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x"
+                      << _hex(rec.self.span_id) << "\",\"ts\":" << at(rec.begin) << ",\"pid\":" << pid
+                      << ",\"tid\":" << rec.tid << "}";
+
+            size += (size_t) event.tellp() + 2;
+            if(max_bytes && size > max_bytes) break;
+            events.push_back(event.str());
+        }
+        for(auto it = events.rbegin(); it != events.rend(); ++it) {
+            sep();
+            out << *it;
+        }
+        out << "]}";
+        return out.str();
+    }
+
+    void clear() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        for(auto b: r.buffers) b->cleared.store(b->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef NEWCORE_TRACE_H
+#define NEWCORE_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* spans over the stages of a transaction, timed with the cpu timestamp counter. Each thread appends the spans it
+ * closes to a buffer of its own, the oldest are overwritten; exporting merges the buffers into the Chrome trace
+ * event format, which chrome://tracing and Perfetto open. A span knows its trace and its parent: the context
+ * travels between services as "<trace>:<span>" in hex, so a chain of requests is one trace end to end.
+ * When tracing is off a span costs a relaxed load. */
+namespace trace {
+
+    static const size_t     BUFFER_SPANS = 4096;        // per thread
+
+    struct Context {
+        uint64_t            trace_id = 0;
+        uint64_t            span_id = 0;
+        bool                valid() const { return trace_id != 0; }
+    };
+
+    extern std::atomic<bool> on;
+    inline bool             enabled() { return on.load(std::memory_order_relaxed); }
+    void                    enable(bool enabled);
+
+    uint64_t                ticks();
+    Context                 current();                  // innermost open span of this thread
+    std::string             header();                   // the current context, to pass along
+    Context                 parse(const std::string& header);
+    void                    name_thread(const std::string& name);
+
+    class Span {
+    public:
+        explicit Span(const char* name);                // a child of the current span, or a new trace
+        Span(const char* name, const Context& parent);  // continues a trace from elsewhere, if valid
+        ~Span();
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        void                open(const Context& parent);
+
+        const char*         name;                       // a literal, only the pointer is kept
+        bool                active = false;
+        uint64_t            begin = 0;
+        Context             self;
+        Context             parent;
+        Context             previous;                   // restored as current on close
+    };
+
+    std::string             chrome_json(size_t max_spans = 0, size_t max_bytes = 0);   // the newest, 0 for all
+    void                    clear();
+}
+
+#endif //NEWCORE_TRACE_H
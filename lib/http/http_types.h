@@ -45,7 +45,11 @@ namespace http {
         uint32_t status;
     };
 
-    void http_free(Message* msg);
+    /* messages handed around by pointer come from a per-thread pool: new_* returns one without headers or body,
+     * http_free gives it back with the capacity of its buffers. Never delete them */
+    Request*    new_request();
+    Response*   new_response();
+    void        http_free(Message* msg);
 }
 
 
@@ -1,5 +1,6 @@
 #include <regex>
 #include <core/logger.h>
+#include <core/pool.h>
 #include <http/uri_t.hpp>
 
 #include "http/parser.h"
@@ -86,7 +87,7 @@ namespace http {
         settings.on_message_complete = on_message_complete;
     }
 
-    bool parser::parse(const std::string &body, enum http_parser_type type, Message **result) {
+    bool parser::parse(const std::string &body, enum http_parser_type type, Message *result) {
         if (core.type != type) {
             http_parser_init(&core, type);
         }
@@ -101,23 +102,21 @@ namespace http {
         std::string *the_appropriate_body;
         if (HTTP_PARSER_ERRNO(&core) == HPE_OK) {
             if (core.type == HTTP_REQUEST) {
-                *result = new Request();
                 headers = &request_headers;
                 the_appropriate_body = &request_body;
-                ((Request *) (*result))->method = http_method_from_str(method.data());
-                ((Request *) (*result))->path = url;
-            } else if (core.type == HTTP_RESPONSE) {
-                *result = new Response();
+                ((Request *) result)->method = http_method_from_str(method.data());
+                ((Request *) result)->path = url;
+            } else {
                 headers = &response_headers;
                 the_appropriate_body = &response_body;
-                ((Response *) (*result))->status = get_status();
+                ((Response *) result)->status = get_status();
             }
-            for (auto &&h:*headers)
-                (*result)->headers[h.first] = h.second;
+            // assigned whole, a recycled message reuses the nodes and the buffers it already has
+            result->headers = *headers;
 
             if(!the_appropriate_body->empty())
                 the_appropriate_body->pop_back();
-            (*result)->body.append(*the_appropriate_body);
+            result->body.assign(*the_appropriate_body);
         } else {
             std::cerr << http_errno_name(HTTP_PARSER_ERRNO(&core));
         }
@@ -129,11 +128,6 @@ namespace http {
         return response_body;
     }
 
-    void parser::set_addr(const std::string &src_addr, const std::string &dst_addr) {
-        this->request_address = src_addr;
-        this->response_address = dst_addr;
-    }
-
     int parser::on_url(http_parser_core *the_parser, const char *at, size_t length) {
         parser *self = reinterpret_cast<parser *>(the_parser->data);
         self->url.assign(at, length);
@@ -209,99 +203,50 @@ namespace http {
         return 0;
     }
 
-    bool parser::filter_url(const std::regex *url_filter, const std::string &url) {
-        return !url_filter ? true : std::regex_search(url, *url_filter);
+    bool parse_request(const std::string &src, Request *out) {
+        http::parser parser;
+        out->success = parser.parse(src, HTTP_REQUEST, out);
+        return out->success;
     }
 
-    void parser::save_http_request(const std::regex *url_filter, const std::string &output_path,
-                                   const std::string &join_addr) {
-        std::string host_with_url = host + url;
-        if (!filter_url(url_filter, host_with_url)) {
-            return;
-        }
-        std::cout << ANSI_COLOR_CYAN << request_address << " -> " << response_address << " " << host_with_url
-                  << ANSI_COLOR_RESET << std::endl;
-        if (!output_path.empty()) {
-            std::string save_filename = output_path + "/" + host;
-            std::ofstream out(save_filename.c_str(), std::ios::app | std::ios::out);
-            if (out.is_open()) {
-                out << *this << std::endl;
-                out.close();
-            } else {
-                std::cerr << "ofstream [" << save_filename << "] is not opened." << std::endl;
-                out.close();
-                exit(1);
-            }
-        } else {
-            std::cout << *this << std::endl;
-        }
+    bool parse_response(const std::string &src, Response *out) {
+        http::parser parser;
+        out->success = parser.parse(src, HTTP_RESPONSE, out);
+        return out->success;
     }
 
-    std::ostream &operator<<(std::ostream &out, const parser &the_parser) {
-        out
-                << ANSI_COLOR_GREEN
-                << the_parser.request_header
-                << ANSI_COLOR_RESET;
-        if (!is_atty || is_plain_text(the_parser.request_body)) {
-            out << the_parser.request_body;
-        } else {
-            out << ANSI_COLOR_RED << "[binary request body]" << ANSI_COLOR_RESET;
-        }
-        out << std::endl
-            << ANSI_COLOR_BLUE
-            << the_parser.response_header
-            << ANSI_COLOR_RESET;
-        if (the_parser.response_body.empty()) {
-            out << ANSI_COLOR_RED << "[empty response body]" << ANSI_COLOR_RESET;
-        } else if (!is_atty || is_plain_text(the_parser.response_body)) {
-            out << the_parser.response_body;
-        } else {
-            out << ANSI_COLOR_RED << "[binary response body]" << ANSI_COLOR_RESET;
-        }
-        return out;
+    bool parse_request(const void *src, size_t len, Request *out) {
+        std::string wrapper((char *) src, len);
+        return parse_request(wrapper, out);
     }
 
-    std::ofstream &operator<<(std::ofstream &out, const parser &the_parser) {
-        out
-                << the_parser.request_header
-                << the_parser.request_body
-                << the_parser.response_header
-                << the_parser.response_body;
-        return out;
+    bool parse_response(const void *src, size_t len, Response *out) {
+        std::string wrapper((char *) src, len);
+        return parse_response(wrapper, out);
     }
 
-    inline Request parse_request(const std::string &src) {
-        http::parser parser;
-        http::Message *parsed;
+    Request parse_request(const std::string &src) {
         Request ret;
-        if (parser.parse(src, HTTP_REQUEST, &parsed)) {
-            ret = *((Request *) parsed);
-            http_free(parsed);
-            ret.success = true;
-        }
+        parse_request(src, &ret);
         return ret;
     }
 
-    inline Response parse_response(const std::string &src) {
-        http::parser parser;
-        http::Message *parsed;
+    Response parse_response(const std::string &src) {
         Response ret;
-        if (parser.parse(src, HTTP_RESPONSE, &parsed)) {
-            ret = *((Response *) parsed);
-            http_free(parsed);
-            ret.success = true;
-        }
+        parse_response(src, &ret);
         return ret;
     }
 
     Request parse_request(const void *src, size_t len) {
-        std::string wrapper((char *) src, len);
-        return parse_request(wrapper);
+        Request ret;
+        parse_request(src, len, &ret);
+        return ret;
     }
 
     Response parse_response(const void *src, size_t len) {
-        std::string wrapper((char *) src, len);
-        return parse_response(wrapper);
+        Response ret;
+        parse_response(src, len, &ret);
+        return ret;
     }
 
 
@@ -339,6 +284,41 @@ namespace http {
     }
 
 
+    /* cheap checks on a raw message, for the paths that must not pay for a full parse */
+
+    bool peek_request(const void *src, size_t len) {
+        return len > 0 && !(len >= 5 && memcmp(src, "HTTP/", 5) == 0);
+    }
+
+    bool peek_header(const void *src, size_t len, const std::string &key, std::string *value) {
+        auto begin = (const char *) src;
+        auto end = begin + len;
+
+        // skip the start line
+        auto line = (const char *) memchr(begin, '\n', len);
+        if (!line) return false;
+        line++;
+
+        while (line < end) {
+            auto eol = (const char *) memchr(line, '\n', end - line);
+            if (!eol) eol = end;
+            auto last = eol > line && *(eol - 1) == '\r' ? eol - 1 : eol;
+            if (last == line) return false;     // end of the headers
+
+            auto colon = (const char *) memchr(line, ':', last - line);
+            if (colon && (size_t) (colon - line) == key.size() && strncasecmp(line, key.data(), key.size()) == 0) {
+                auto v = colon + 1;
+                while (v < last && (*v == ' ' || *v == '\t')) v++;
+                auto v_end = last;
+                while (v_end > v && (*(v_end - 1) == ' ' || *(v_end - 1) == '\t')) v_end--;
+                value->assign(v, v_end - v);
+                return true;
+            }
+            line = eol + 1;
+        }
+        return false;
+    }
+
     const headers_map &parser::get_request_headers_map() {
         return request_headers;
     }
@@ -363,18 +343,38 @@ namespace http {
         return url;
     }
 
+    Request *new_request() {
+        auto request = Pool<Request>::acquire();
+        request->headers.clear();
+        return request;
+    }
+
+    Response *new_response() {
+        auto response = Pool<Response>::acquire();
+        response->headers.clear();
+        return response;
+    }
+
+    /* the headers are left for whoever takes the message next: new_* clears them, a parse assigns over them */
     void http_free(Message *msg) {
         if (!msg) return;
+        msg->body.clear();
+        msg->success = false;
+        msg->more = false;
 
         switch (msg->type) {
             case REQUEST: {
                 Request *casted = (Request *) msg;
-                delete casted;
+                casted->method = HTTP_INVALID_METHOD;
+                casted->path.clear();
+                casted->uri.clear();
+                Pool<Request>::release(casted);
                 break;
             }
             case RESPONSE: {
                 Response *casted = (Response *) msg;
-                delete casted;
+                casted->status = 0;
+                Pool<Response>::release(casted);
                 break;
             }
         }
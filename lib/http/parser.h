@@ -11,9 +11,6 @@
 namespace http {
     class parser {
 
-        friend std::ofstream &operator<<(std::ofstream &out, const parser &f);
-        friend std::ostream &operator<<(std::ostream &out, const parser &f);
-
     private:
         http_parser_core        core;
         http_parser_settings    settings;
@@ -26,9 +23,6 @@ namespace http {
     private:
         std::string url;
 
-        std::string request_address;
-        std::string response_address;
-
         std::string request;
         std::string request_header;
         std::string request_body;
@@ -49,7 +43,7 @@ namespace http {
 
     public:
         parser();
-        bool                parse(const std::string &body, enum http_parser_type type, Message** result);
+        bool                parse(const std::string &body, enum http_parser_type type, Message* result);
 
         const std::string&  get_response_body() const;
         const std::string&  get_request_body() const;
@@ -64,14 +58,6 @@ namespace http {
             return request_complete_flag;
         }
 
-        inline bool         is_request_address(const std::string &address) const {
-            return request_address == address;
-        }
-
-        void                set_addr(const std::string &src_addr, const std::string &dst_addr);
-        bool                filter_url(const std::regex *url_filter, const std::string &url);
-        void                save_http_request(
-                const std::regex *url_filter, const std::string &output_path, const std::string &join_addr);
         const headers_map&  get_request_headers_map();
         const headers_map&  get_response_headers_map();
         static int          on_url(http_parser_core *the_parser, const char *at, size_t length);
@@ -82,15 +68,21 @@ namespace http {
         static int          on_message_complete(http_parser_core *the_parser);
     };
 
-    std::ostream &operator<<(std::ostream &out, const parser &the_parser);
-    std::ofstream &operator<<(std::ofstream &out, const parser &the_parser);
-
     Request           parse_request(const std::string& src);
     Response          parse_response(const std::string& src);
 
     Request           parse_request(const void * src, size_t len);
     Response          parse_response(const void * src, size_t len);
 
+    /* into an existing message, typically one from new_request/new_response: its buffers are reused */
+    bool              parse_request(const std::string& src, Request* out);
+    bool              parse_response(const std::string& src, Response* out);
+    bool              parse_request(const void * src, size_t len, Request* out);
+    bool              parse_response(const void * src, size_t len, Response* out);
+
     std::string         serialize(const Message * msg);
+
+    bool                peek_request(const void * src, size_t len);
+    bool                peek_header(const void * src, size_t len, const std::string& key, std::string* value);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include "capture.h"
+
+namespace QhmSockets
+{
+
+    static const uint32_t PCAP_MAGIC = 0xa1b2c3d4;
+    static const uint32_t PCAP_MAGIC_NANO = 0xa1b23c4d;
+    static const uint32_t PCAP_SNAPLEN = 65535 + 48;
+    static const uint32_t LINKTYPE_ETHERNET = 1;
+    static const uint32_t LINKTYPE_RAW = 101;
+    static const uint32_t LINKTYPE_LINUX_SLL = 113;
+    static const uint32_t LINKTYPE_IPV4 = 228;
+    static const uint32_t LINKTYPE_IPV6 = 229;
+    static const uint8_t  IPPROTO_UDP_NUMBER = 17;
+
+    struct PcapHeader {
+        uint32_t    magic;
+        uint16_t    version_major;
+        uint16_t    version_minor;
+        int32_t     thiszone;
+        uint32_t    sigfigs;
+        uint32_t    snaplen;
+        uint32_t    linktype;
+    };
+
+    struct PcapRecord {
+        uint32_t    sec;
+        uint32_t    usec;
+        uint32_t    captured;
+        uint32_t    length;
+    };
+
+    static void _put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t) (v >> 8); p[1] = (uint8_t) v; }
+    static uint16_t _get16(const uint8_t* p) { return (uint16_t) (p[0] << 8 | p[1]); }
+
+    /* one's complement sum, over big endian 16 bit words */
+    static uint32_t _sum(const void* data, size_t len, uint32_t sum = 0) {
+        auto p = (const uint8_t*) data;
+        for (; len > 1; len -= 2, p += 2) sum += (uint32_t) (p[0] << 8 | p[1]);
+        if (len) sum += (uint32_t) (p[0] << 8);
+        return sum;
+    }
+
+    static uint16_t _fold(uint32_t sum) {
+        while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+        return (uint16_t) ~sum;
+    }
+
+    static int64_t _now() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+
+    /* the address as it goes in a header of the given family, v4 ones are mapped into v6 */
+    static void _address(const SockAddr& addr, bool v6, uint8_t* out, uint16_t* port) {
+        memset(out, 0, v6 ? 16 : 4);
+        *port = 0;
+        if (!addr.valid()) return;
+        if (addr.storage.ss_family == AF_INET) {
+            auto in = (const struct sockaddr_in*) &addr.storage;
+            *port = ntohs(in->sin_port);
+            if (!v6) memcpy(out, &in->sin_addr, 4);
+            else { out[10] = out[11] = 0xff; memcpy(out + 12, &in->sin_addr, 4); }
+        } else if (addr.storage.ss_family == AF_INET6 && v6) {
+            auto in6 = (const struct sockaddr_in6*) &addr.storage;
+            *port = ntohs(in6->sin6_port);
+            memcpy(out, &in6->sin6_addr, 16);
+        }
+    }
+
+    static void _sockaddr(const uint8_t* address, bool v6, uint16_t port, SockAddr* out) {
+        memset(&out->storage, 0, sizeof(out->storage));
+        if (v6) {
+            auto in6 = (struct sockaddr_in6*) &out->storage;
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            memcpy(&in6->sin6_addr, address, 16);
+            out->len = sizeof(struct sockaddr_in6);
+        } else {
+            auto in = (struct sockaddr_in*) &out->storage;
+            in->sin_family = AF_INET;
+            in->sin_port = htons(port);
+            memcpy(&in->sin_addr, address, 4);
+            out->len = sizeof(struct sockaddr_in);
+        }
+    }
+
+    CaptureWriter::~CaptureWriter() {
+        close();
+    }
+
+    bool CaptureWriter::open(const std::string& path) {
+        close();
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        PcapHeader header = { PCAP_MAGIC, 2, 4, 0, 0, PCAP_SNAPLEN, LINKTYPE_RAW };
+        fwrite(&header, sizeof(header), 1, file);
+        return true;
+    }
+
+    void CaptureWriter::write(int64_t time, const SockAddr& source, const SockAddr& destination,
+                              const void* data, size_t len) {
+        if (!file) return;
+        bool v6 = source.valid() && source.storage.ss_family == AF_INET6;
+        size_t ip_len = v6 ? 40 : 20;
+        uint8_t headers[48] = {0};
+        uint8_t src[16], dst[16];
+        uint16_t sport, dport;
+        _address(source, v6, src, &sport);
+        _address(destination, v6, dst, &dport);
+
+        uint8_t* ip = headers;
+        uint8_t* udp = headers + ip_len;
+        uint16_t udp_len = (uint16_t) (8 + len);
+        uint32_t pseudo;
+        if (v6) {
+            ip[0] = 0x60;
+            _put16(ip + 4, udp_len);
+            ip[6] = IPPROTO_UDP_NUMBER;
+            ip[7] = 64;
+            memcpy(ip + 8, src, 16);
+            memcpy(ip + 24, dst, 16);
+            pseudo = _sum(src, 16, _sum(dst, 16)) + udp_len + IPPROTO_UDP_NUMBER;
+        } else {
+            ip[0] = 0x45;
+            _put16(ip + 2, (uint16_t) (ip_len + udp_len));
+            _put16(ip + 6, 0x4000);             // don't fragment
+            ip[8] = 64;
+            ip[9] = IPPROTO_UDP_NUMBER;
+            memcpy(ip + 12, src, 4);
+            memcpy(ip + 16, dst, 4);
+            _put16(ip + 10, _fold(_sum(ip, 20)));
+            pseudo = _sum(src, 4, _sum(dst, 4)) + udp_len + IPPROTO_UDP_NUMBER;
+        }
+        _put16(udp, sport);
+        _put16(udp + 2, dport);
+        _put16(udp + 4, udp_len);
+        uint16_t checksum = _fold(_sum(data, len, _sum(udp, 8, pseudo)));
+        _put16(udp + 6, checksum ? checksum : 0xffff);
+
+        PcapRecord record = { (uint32_t) (time / 1000000), (uint32_t) (time % 1000000),
+                              (uint32_t) (ip_len + udp_len), (uint32_t) (ip_len + udp_len) };
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(headers, 1, ip_len + 8, file);
+        fwrite(data, 1, len, file);
+    }
+
+    void CaptureWriter::write(const CapturedDatagram& datagram) {
+        write(datagram.time, datagram.source, datagram.destination, datagram.payload.data(), datagram.payload.size());
+    }
+
+    void CaptureWriter::close() {
+        if (file) fclose(file);
+        file = nullptr;
+    }
+
+    CaptureReader::~CaptureReader() {
+        if (file) fclose(file);
+    }
+
+    bool CaptureReader::open(const std::string& path) {
+        if (file) fclose(file);
+        file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        PcapHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1) return false;
+        swapped = header.magic == __builtin_bswap32(PCAP_MAGIC) || header.magic == __builtin_bswap32(PCAP_MAGIC_NANO);
+        uint32_t magic = swapped ? __builtin_bswap32(header.magic) : header.magic;
+        if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NANO) return false;
+        nanoseconds = magic == PCAP_MAGIC_NANO;
+        linktype = swapped ? __builtin_bswap32(header.linktype) : header.linktype;
+        return linktype == LINKTYPE_RAW || linktype == LINKTYPE_ETHERNET || linktype == LINKTYPE_LINUX_SLL
+               || linktype == LINKTYPE_IPV4 || linktype == LINKTYPE_IPV6;
+    }
+
+    bool CaptureReader::next(CapturedDatagram* out) {
+        PcapRecord record;
+        while (file && fread(&record, sizeof(record), 1, file) == 1) {
+            if (swapped) {
+                record.sec = __builtin_bswap32(record.sec);
+                record.usec = __builtin_bswap32(record.usec);
+                record.captured = __builtin_bswap32(record.captured);
+            }
+            if (record.captured > PCAP_SNAPLEN * 4) return false;
+            frame.resize(record.captured);
+            if (record.captured && fread(frame.data(), 1, record.captured, file) != record.captured) return false;
+            auto p = (const uint8_t*) frame.data();
+            size_t size = frame.size(), at = 0;
+
+            // down to the ip header
+            if (linktype == LINKTYPE_ETHERNET) {
+                at = 14;
+                if (size >= 18 && _get16(p + 12) == 0x8100) at = 18;     // a vlan tag
+            } else if (linktype == LINKTYPE_LINUX_SLL) at = 16;
+            if (size < at + 20) continue;
+
+            bool v6 = (p[at] >> 4) == 6;
+            size_t udp_at;
+            if (v6) {
+                if (size < at + 48 || p[at + 6] != IPPROTO_UDP_NUMBER) continue;
+                _sockaddr(p + at + 8, true, 0, &out->source);
+                _sockaddr(p + at + 24, true, 0, &out->destination);
+                udp_at = at + 40;
+            } else {
+                size_t ihl = (size_t) (p[at] & 0x0f) * 4;
+                if ((p[at] >> 4) != 4 || ihl < 20 || size < at + ihl + 8 || p[at + 9] != IPPROTO_UDP_NUMBER) continue;
+                _sockaddr(p + at + 12, false, 0, &out->source);
+                _sockaddr(p + at + 16, false, 0, &out->destination);
+                udp_at = at + ihl;
+            }
+            uint16_t sport = _get16(p + udp_at), dport = _get16(p + udp_at + 2);
+            if (v6) {
+                ((struct sockaddr_in6*) &out->source.storage)->sin6_port = htons(sport);
+                ((struct sockaddr_in6*) &out->destination.storage)->sin6_port = htons(dport);
+            } else {
+                ((struct sockaddr_in*) &out->source.storage)->sin_port = htons(sport);
+                ((struct sockaddr_in*) &out->destination.storage)->sin_port = htons(dport);
+            }
+            size_t payload = std::min<size_t>(_get16(p + udp_at + 4) >= 8 ? _get16(p + udp_at + 4) - 8 : 0,
+                                              size - udp_at - 8);
+            out->payload.assign((const char*) p + udp_at + 8, payload);
+            out->time = (int64_t) record.sec * 1000000 + (nanoseconds ? record.usec / 1000 : record.usec);
+            return true;
+        }
+        return false;
+    }
+
+    void FlightRecorder::resize(size_t capacity) {
+        ring.assign(capacity, CapturedDatagram());
+        next = count = 0;
+    }
+
+    void FlightRecorder::record(const Message& message, const SockAddr& destination) {
+        if (ring.empty()) return;
+        auto& slot = ring[next];
+        slot.time = message.arrival_time() ? message.arrival_time() : _now();
+        slot.source = message.source();
+        slot.destination = destination;
+        slot.payload.assign((const char*) message.data(), message.size());
+        next = (next + 1) % ring.size();
+        count = std::min(count + 1, ring.size());
+    }
+
+    bool FlightRecorder::dump(const std::string& path) const {
+        CaptureWriter writer;
+        if (!writer.open(path)) return false;
+        size_t first = (next + ring.size() - count) % std::max<size_t>(ring.size(), 1);
+        for (size_t i = 0; i < count; i++) writer.write(ring[(first + i) % ring.size()]);
+        return true;
+    }
+
+} // namespace QhmSockets
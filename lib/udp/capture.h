@@ -0,0 +1,65 @@
+#ifndef QHM_CAPTURE_H
+#define QHM_CAPTURE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "udp.h"
+
+namespace QhmSockets
+{
+
+    /* datagrams are stored as pcap with LINKTYPE_RAW: each payload behind the IPv4 (or IPv6) and UDP headers it
+     * would have had on the wire, so tcpdump and wireshark open captures as they are. Reading also takes the
+     * ethernet and linux cooked captures tcpdump writes. */
+    struct CapturedDatagram {
+        int64_t             time = 0;           // usec since the epoch
+        SockAddr            source;
+        SockAddr            destination;
+        std::string         payload;
+    };
+
+    class CaptureWriter {
+    public:
+        ~CaptureWriter();
+        bool                open(const std::string& path);
+        bool                is_open() const { return file != nullptr; }
+        void                write(int64_t time, const SockAddr& source, const SockAddr& destination,
+                                  const void* data, size_t len);
+        void                write(const CapturedDatagram& datagram);
+        void                close();
+    private:
+        FILE*               file = nullptr;
+    };
+
+    class CaptureReader {
+    public:
+        ~CaptureReader();
+        bool                open(const std::string& path);
+        bool                next(CapturedDatagram* out);    // false at the end, skips what is not UDP
+    private:
+        FILE*               file = nullptr;
+        bool                swapped = false;
+        bool                nanoseconds = false;
+        uint32_t            linktype = 0;
+        std::vector<char>   frame;
+    };
+
+    /* the last datagrams received, kept in memory. Recording reuses the slots, so once they are warm it costs a
+     * copy of the payload. Not thread safe: one per worker */
+    class FlightRecorder {
+    public:
+        explicit FlightRecorder(size_t capacity = 0) { resize(capacity); }
+        void                resize(size_t capacity);
+        void                record(const Message& message, const SockAddr& destination);
+        size_t              size() const { return count; }
+        bool                dump(const std::string& path) const;    // oldest first
+    private:
+        std::vector<CapturedDatagram>   ring;
+        size_t              next = 0;
+        size_t              count = 0;
+    };
+
+} // namespace QhmSockets
+
+#endif //QHM_CAPTURE_H
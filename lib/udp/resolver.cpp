@@ -0,0 +1,131 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "resolver.h"
+
+namespace QhmSockets
+{
+
+/** \brief Build a sockaddr out of a numeric IPv4/IPv6 literal.
+ *
+ * \return false if \p host is not a literal, in which case it has to go
+ * through the resolver.
+ */
+    bool numeric_address(const std::string& host, int port, SockAddr* out)
+    {
+        memset(&out->storage, 0, sizeof(out->storage));
+        auto in = (struct sockaddr_in*) &out->storage;
+        if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1) {
+            in->sin_family = AF_INET;
+            in->sin_port = htons((uint16_t) port);
+            out->len = sizeof(struct sockaddr_in);
+            return true;
+        }
+        auto in6 = (struct sockaddr_in6*) &out->storage;
+        if (inet_pton(AF_INET6, host.c_str(), &in6->sin6_addr) == 1) {
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons((uint16_t) port);
+            out->len = sizeof(struct sockaddr_in6);
+            return true;
+        }
+        out->len = 0;
+        return false;
+    }
+
+    ResolverCache& ResolverCache::instance()
+    {
+        static ResolverCache cache;
+        return cache;
+    }
+
+/** \brief Resolve \p host : \p port, going to getaddrinfo() at most once per TTL.
+ *
+ * Failures are cached too (for a shorter time) so that a dead name does not
+ * put the resolver back on the request path for every message.
+ */
+    bool ResolverCache::resolve(const std::string& host, int port, SockAddr* out)
+    {
+        if (numeric_address(host, port, out)) {
+            numeric++;
+            return true;
+        }
+
+        std::string key = host + ":" + std::to_string(port);
+        auto now = clock::now();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = entries.find(key);
+            if (it != entries.end() && it->second.expires > now) {
+                *out = it->second.address;
+                out->valid() ? hits++ : negative_hits++;
+                return out->valid();
+            }
+        }
+
+        // resolve without holding the lock, a slow name must not stall the other threads
+        char decimal_port[16];
+        snprintf(decimal_port, sizeof(decimal_port), "%d", port);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_protocol = IPPROTO_UDP;
+        struct addrinfo* info = nullptr;
+        int r(getaddrinfo(host.c_str(), decimal_port, &hints, &info));
+
+        Entry entry;
+        if (r == 0 && info != nullptr) {
+            memcpy(&entry.address.storage, info->ai_addr, info->ai_addrlen);
+            entry.address.len = info->ai_addrlen;
+        }
+        if (info) freeaddrinfo(info);
+
+        lookups++;
+        std::lock_guard<std::mutex> guard(lock);
+        entry.expires = now + (entry.address.valid() ? positive_ttl : negative_ttl);
+        entries[key] = entry;
+
+        // the expired ones go, then the oldest past the capacity. Names resolved again since leave a stale record
+        // behind, which must not evict the fresh entry
+        order.emplace_back(key, entry.expires);
+        while (!order.empty() && (order.front().second <= now || entries.size() > capacity)) {
+            auto oldest = entries.find(order.front().first);
+            if (oldest != entries.end() && oldest->second.expires == order.front().second) entries.erase(oldest);
+            order.pop_front();
+        }
+        *out = entry.address;
+        return out->valid();
+    }
+
+    void ResolverCache::set_ttl(int positive_ms, int negative_ms)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        positive_ttl = std::chrono::milliseconds(positive_ms);
+        negative_ttl = std::chrono::milliseconds(negative_ms);
+    }
+
+    void ResolverCache::set_capacity(size_t max_entries)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        capacity = max_entries;
+    }
+
+    void ResolverCache::clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+        order.clear();
+    }
+
+    ResolverStats ResolverCache::stats()
+    {
+        ResolverStats ret;
+        ret.numeric = numeric;
+        ret.hits = hits;
+        ret.negative_hits = negative_hits;
+        ret.lookups = lookups;
+        std::lock_guard<std::mutex> guard(lock);
+        ret.entries = entries.size();
+        return ret;
+    }
+
+} // namespace QhmSockets
@@ -0,0 +1,64 @@
+#ifndef QHM_RESOLVER_H
+#define QHM_RESOLVER_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include "udp.h"
+
+namespace QhmSockets
+{
+
+#define RESOLVER_POSITIVE_TTL_MS    60000
+#define RESOLVER_NEGATIVE_TTL_MS    5000
+#define RESOLVER_CAPACITY           1024
+
+    struct ResolverStats {
+        uint64_t            numeric = 0;        // literals, never hit the resolver
+        uint64_t            hits = 0;
+        uint64_t            negative_hits = 0;
+        uint64_t            lookups = 0;        // actual getaddrinfo() calls
+        size_t              entries = 0;        // cached right now, failures included
+    };
+
+    /* process-wide host:port -> sockaddr cache, shared by every socket and every messenger */
+    class ResolverCache {
+    public:
+        static ResolverCache&   instance();
+
+        bool                    resolve(const std::string& host, int port, SockAddr* out);
+        void                    set_ttl(int positive_ms, int negative_ms);
+        void                    set_capacity(size_t max_entries);
+        void                    clear();
+        ResolverStats           stats();
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct Entry {
+            SockAddr                address;
+            clock::time_point       expires;
+        };
+
+        ResolverCache() = default;
+
+        std::mutex                              lock;
+        std::unordered_map<std::string, Entry>  entries;
+        std::deque<std::pair<std::string, clock::time_point>> order;   // by insertion, to expire and evict from
+        size_t                                  capacity = RESOLVER_CAPACITY;
+        clock::duration                         positive_ttl = std::chrono::milliseconds(RESOLVER_POSITIVE_TTL_MS);
+        clock::duration                         negative_ttl = std::chrono::milliseconds(RESOLVER_NEGATIVE_TTL_MS);
+        std::atomic<uint64_t>                   numeric{0};
+        std::atomic<uint64_t>                   hits{0};
+        std::atomic<uint64_t>                   negative_hits{0};
+        std::atomic<uint64_t>                   lookups{0};
+    };
+
+    bool                numeric_address(const std::string& host, int port, SockAddr* out);
+
+} // namespace QhmSockets
+
+#endif //QHM_RESOLVER_H
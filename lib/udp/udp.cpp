@@ -21,15 +21,111 @@
 
 #include <string.h>
 #include <unistd.h>
+#include <memory>
 #include <random>
 #include <arpa/inet.h>
+#include <sys/time.h>
 #include "udp.h"
+#include "resolver.h"
 #include "core/common.h"
 
 
 namespace QhmSockets
 {
 
+// ========================= ADDRESSES =========================
+
+/** \brief Split an "[scheme://]host:port" endpoint.
+ *
+ * The port is taken after the last colon, so bracketed IPv6 literals
+ * ("[::1]:40401") are accepted as well.
+ *
+ * \return false if the endpoint has no valid port.
+ */
+    bool split_endpoint(const std::string& endpoint, std::string* host, int* port)
+    {
+        size_t skip = 0;
+        if (endpoint.compare(0, 7, "http://") == 0) skip = 7;
+        else if (endpoint.compare(0, 6, "tcp://") == 0 || endpoint.compare(0, 6, "udp://") == 0) skip = 6;
+
+        auto colon = endpoint.rfind(':');
+        if (colon == std::string::npos || colon < skip) return false;
+
+        *host = endpoint.substr(skip, colon - skip);
+        if (host->size() >= 2 && host->front() == '[' && host->back() == ']')
+            *host = host->substr(1, host->size() - 2);
+
+        char* end = nullptr;
+        long p = strtol(endpoint.c_str() + colon + 1, &end, 10);
+        if (end == endpoint.c_str() + colon + 1 || *end != '\0' || p < 0 || p > 65535) return false;
+        *port = (int) p;
+        return true;
+    }
+
+/** \brief Resolve a host and a port into a sockaddr usable with sendto().
+ *
+ * Goes through the process-wide ResolverCache: numeric literals never reach
+ * the resolver, names reach it at most once per TTL.
+ */
+    bool resolve_address(const std::string& host, int port, SockAddr* out)
+    {
+        return ResolverCache::instance().resolve(host, port, out);
+    }
+
+/** \brief Check whether a resolved address is the numeric \p host : \p port.
+ *
+ * No resolution is attempted: a host that is not a numeric literal never
+ * matches.
+ */
+    bool same_address(const SockAddr& addr, const std::string& host, int port)
+    {
+        if (!addr.valid()) return false;
+        switch (addr.storage.ss_family) {
+            case AF_INET: {
+                auto in = (const struct sockaddr_in*) &addr.storage;
+                struct in_addr other;
+                return ntohs(in->sin_port) == port && inet_pton(AF_INET, host.c_str(), &other) == 1
+                       && other.s_addr == in->sin_addr.s_addr;
+            }
+            case AF_INET6: {
+                auto in6 = (const struct sockaddr_in6*) &addr.storage;
+                struct in6_addr other;
+                return ntohs(in6->sin6_port) == port && inet_pton(AF_INET6, host.c_str(), &other) == 1
+                       && memcmp(&other, &in6->sin6_addr, sizeof(other)) == 0;
+            }
+            default:
+                return false;
+        }
+    }
+
+/** \brief Format a resolved address as "host:port", for logging. */
+    std::string address_string(const SockAddr& addr)
+    {
+        char host[INET6_ADDRSTRLEN] = {0};
+        int port = 0;
+        if (addr.valid() && addr.storage.ss_family == AF_INET) {
+            auto in = (const struct sockaddr_in*) &addr.storage;
+            inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+            port = ntohs(in->sin_port);
+        } else if (addr.valid() && addr.storage.ss_family == AF_INET6) {
+            auto in6 = (const struct sockaddr_in6*) &addr.storage;
+            inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+            port = ntohs(in6->sin6_port);
+        }
+        return std::string(host) + ":" + std::to_string(port);
+    }
+
+    bool resolve_endpoint(const std::string& endpoint, SockAddr* out)
+    {
+        std::string host;
+        int port;
+        if (!split_endpoint(endpoint, &host, &port)) {
+            out->len = 0;
+            return false;
+        }
+        return resolve_address(host, port, out);
+    }
+
 
 // ========================= CLIENT =========================
 
@@ -50,8 +146,9 @@ namespace QhmSockets
  * socket will be closed by the operating system.
  *
  * \warning
- * We only make use of the first address found by getaddrinfo(). All
- * the other addresses are ignored.
+ * The address goes through resolve_address(), hence through the
+ * process-wide ResolverCache. We only make use of the first address found
+ * by getaddrinfo(). All the other addresses are ignored.
  *
  * \exception udp_client_server_runtime_error
  * The server could not be initialized properly. Either the address cannot be
@@ -68,20 +165,13 @@ namespace QhmSockets
         char decimal_port[16];
         snprintf(decimal_port, sizeof(decimal_port), "%d", f_port);
         decimal_port[sizeof(decimal_port) / sizeof(decimal_port[0]) - 1] = '\0';
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_protocol = IPPROTO_UDP;
-        int r(getaddrinfo(addr.c_str(), decimal_port, &hints, &f_addrinfo));
-        if(r != 0 || f_addrinfo == NULL)
+        if(!resolve_address(addr, f_port, &f_address))
         {
             throw udp_client_server_runtime_error(("invalid address or port: \"" + addr + ":" + decimal_port + "\"").c_str());
         }
-        f_socket = socket(f_addrinfo->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+        f_socket = socket(f_address.storage.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
         if(f_socket == -1)
         {
-            freeaddrinfo(f_addrinfo);
             throw udp_client_server_runtime_error(("could not create socket for: \"" + addr + ":" + decimal_port + "\"").c_str());
         }
     }
@@ -96,22 +186,15 @@ namespace QhmSockets
         char decimal_port[16];
         snprintf(decimal_port, sizeof(decimal_port), "%d", f_port);
         decimal_port[sizeof(decimal_port) / sizeof(decimal_port[0]) - 1] = '\0';
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_protocol = IPPROTO_UDP;
-        int r(getaddrinfo(inaddr.c_str(), decimal_port, &hints, &f_addrinfo));
-        if(r != 0 || f_addrinfo == NULL)
+        if(!resolve_address(inaddr, f_port, &f_address))
         {
             throw udp_client_server_runtime_error(("invalid address or port: \"" + inaddr + ":" + decimal_port + "\"").c_str());
         }
-        f_socket = socket(f_addrinfo->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+        f_socket = socket(f_address.storage.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
 
 
         if(f_socket == -1)
         {
-            freeaddrinfo(f_addrinfo);
             throw udp_client_server_runtime_error(("could not create socket for: \"" + inaddr + ":" + decimal_port + "\"").c_str());
         } else {
             struct sockaddr_in sa;
@@ -126,12 +209,10 @@ namespace QhmSockets
 
 /** \brief Clean up the UDP client object.
  *
- * This function frees the address information structure and close the socket
- * before returning.
+ * This function closes the socket before returning.
  */
     udp_client::~udp_client()
     {
-        freeaddrinfo(f_addrinfo);
         close(f_socket);
     }
 
@@ -193,7 +274,7 @@ namespace QhmSockets
  */
     int udp_client::send(const char *msg, size_t size)
     {
-        return sendto(f_socket, msg, size, 0, f_addrinfo->ai_addr, f_addrinfo->ai_addrlen);
+        return sendto(f_socket, msg, size, 0, f_address.addr(), f_address.len);
     }
 
     void udp_client::setip(const std::string &ip) {
@@ -228,8 +309,9 @@ namespace QhmSockets
  * socket will be closed by the operating system.
  *
  * \warning
- * We only make use of the first address found by getaddrinfo(). All
- * the other addresses are ignored.
+ * The address goes through resolve_address(), hence through the
+ * process-wide ResolverCache. We only make use of the first address found
+ * by getaddrinfo(). All the other addresses are ignored.
  *
  * \exception udp_client_server_runtime_error
  * The udp_client_server_runtime_error exception is raised when the address
@@ -246,38 +328,32 @@ namespace QhmSockets
         char decimal_port[16];
         snprintf(decimal_port, sizeof(decimal_port), "%d", f_port);
         decimal_port[sizeof(decimal_port) / sizeof(decimal_port[0]) - 1] = '\0';
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_protocol = IPPROTO_UDP;
-        int r(getaddrinfo(addr.c_str(), decimal_port, &hints, &f_addrinfo));
-        if(r != 0 || f_addrinfo == NULL)
+        if(!resolve_address(addr, f_port, &f_address))
         {
             throw udp_client_server_runtime_error(("invalid address or port for UDP socket: \"" + addr + ":" + decimal_port + "\"").c_str());
         }
-        f_socket = socket(f_addrinfo->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+        f_socket = socket(f_address.storage.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
         if(f_socket == -1)
         {
-            freeaddrinfo(f_addrinfo);
             throw udp_client_server_runtime_error(("could not create UDP socket for: \"" + addr + ":" + decimal_port + "\"").c_str());
         }
-        r = bind(f_socket, f_addrinfo->ai_addr, f_addrinfo->ai_addrlen);
+        int r = bind(f_socket, f_address.addr(), f_address.len);
         if(r != 0)
         {
-            freeaddrinfo(f_addrinfo);
             close(f_socket);
             throw udp_client_server_runtime_error(("could not bind UDP socket with: \"" + addr + ":" + decimal_port + "\"").c_str());
         }
+        // have the kernel stamp datagrams on arrival, time spent queued in the socket is visible to the receiver
+        int on = 1;
+        ::setsockopt(f_socket, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
     }
 
 /** \brief Clean up the UDP server.
  *
- * This function frees the address info structures and close the socket.
+ * This function closes the socket.
  */
     udp_server::~udp_server()
     {
-        freeaddrinfo(f_addrinfo);
         close(f_socket);
     }
 
@@ -386,7 +462,50 @@ namespace QhmSockets
     }
 
 
-    int udp_server::timed_recvfrom(char *msg, size_t max_size, int max_wait_ms, sockaddr *addr, socklen_t *len) {
+/** \brief Receive a datagram, scattered over \p iov, along with the time the
+ * kernel received it.
+ *
+ * \param[out] arrival  If not null, set to the arrival time in microseconds
+ *                      since the epoch, or 0 when the kernel did not stamp it.
+ */
+    static int recvmsg_stamped(int fd, struct iovec *iov, size_t iovcnt, int flags, sockaddr *addr, socklen_t *len,
+                               int64_t *arrival) {
+        char control[CMSG_SPACE(sizeof(struct timeval))];
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = addr;
+        hdr.msg_namelen = len ? *len : 0;
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = iovcnt;
+        if(arrival) {
+            hdr.msg_control = control;
+            hdr.msg_controllen = sizeof(control);
+        }
+
+        int read = (int) ::recvmsg(fd, &hdr, flags);
+        if(len) *len = hdr.msg_namelen;
+        if(!arrival) return read;
+        *arrival = 0;
+        for(struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); read >= 0 && c; c = CMSG_NXTHDR(&hdr, c))
+            if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMP) {
+                struct timeval tv;
+                memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+                *arrival = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+            }
+        return read;
+    }
+
+    int udp_server::timed_recvfrom(char *msg, size_t max_size, int max_wait_ms, sockaddr *addr, socklen_t *len,
+                                   int64_t *arrival) {
+        struct iovec iov = { msg, max_size };
+        return timed_recvmsg(&iov, 1, max_wait_ms, addr, len, arrival);
+    }
+
+    int udp_server::timed_recvmsg(struct iovec *iov, size_t iovcnt, int max_wait_ms, sockaddr *addr, socklen_t *len,
+                                  int64_t *arrival) {
+
+        // a zero wait only polls what is already queued: one syscall, no select()
+        if(max_wait_ms == 0) return recvmsg_stamped(f_socket, iov, iovcnt, MSG_DONTWAIT, addr, len, arrival);
 
         fd_set s;
         FD_ZERO(&s);
@@ -403,7 +522,7 @@ namespace QhmSockets
         if(retval > 0)
         {
             // our socket has data
-            return ::recvfrom(f_socket, msg, max_size, 0, addr, len);
+            return recvmsg_stamped(f_socket, iov, iovcnt, 0, addr, len, arrival);
         }
 
         // our socket has no data
@@ -411,35 +530,40 @@ namespace QhmSockets
         return -1;
     }
 
+    /* receive buffers, shared by the sockets of a thread instead of 64 KB inline in each of them. A datagram is
+     * scattered over an MTU sized buffer, the only one most of them touch, and spills into the large one only when
+     * it does not fit: its pages stay cold until some peer sends that much */
+    struct RecvBuffers {
+        char                        mtu[MTU_BUFFER_LEN];
+        std::unique_ptr<char[]>     large {new char[BUFFER_LEN - MTU_BUFFER_LEN]};
+    };
 
     void Socket::setsockopt(int key, int val) {
         options[key] = val;
     }
 
     std::string Socket::recv() {
-        core_assert(server_initialized, return "");
-        int read;
-        struct sockaddr_in addr;
-        socklen_t len = sizeof(addr);
-        if(options.find(RCVTIMEO) != options.end())
-            read = server->timed_recvfrom(buffer, BUFFER_LEN, options[RCVTIMEO], (struct sockaddr*)&addr, &len);
-        else
-            read = server->timed_recvfrom(buffer, BUFFER_LEN, 1000000, (struct sockaddr*)&addr, &len);
-
-        sender = std::string(inet_ntoa(addr.sin_addr) + std::string(":") + std::to_string(ntohs(addr.sin_port) + 1));
-
-        return read > 0 ? std::string(buffer, read) : "";
+        auto timeout = options.find(RCVTIMEO);
+        return receive(timeout != options.end() ? timeout->second : 1000000);
     }
 
     std::string Socket::recv(int timeout) {
+        return receive(timeout);
+    }
+
+    std::string Socket::receive(int timeout) {
         core_assert(server_initialized, return "");
-        int read;
-        struct sockaddr_in addr;
-        socklen_t len = sizeof(addr);
-        read = server->timed_recvfrom(buffer, BUFFER_LEN, timeout, (struct sockaddr*)&addr, &len);
-        sender = std::string(inet_ntoa(addr.sin_addr) + std::string(":") + std::to_string(ntohs(addr.sin_port) + 1));
+        static thread_local RecvBuffers buffers;
+        struct iovec iov[2] = { {buffers.mtu, MTU_BUFFER_LEN}, {buffers.large.get(), BUFFER_LEN - MTU_BUFFER_LEN} };
+        sender.len = sizeof(sender.storage);
+        int read = server->timed_recvmsg(iov, 2, timeout, (struct sockaddr*)&sender.storage, &sender.len, &arrival);
+        if(read <= 0) { sender.len = 0; return ""; }
 
-        return read > 0 ? std::string(buffer, read) : "";
+        if(read <= MTU_BUFFER_LEN) return std::string(buffers.mtu, read);
+        std::string datagram;
+        datagram.reserve(read);
+        datagram.append(buffers.mtu, MTU_BUFFER_LEN).append(buffers.large.get(), read - MTU_BUFFER_LEN);
+        return datagram;
     }
 
     Socket::Socket() {
@@ -450,7 +574,7 @@ namespace QhmSockets
         // allow for multiple endpoints
         core_assert(!server_initialized, return;);
         core_assert(parse_endpoint(endpoint), return );
-        try { server = new udp_server(address, port); } catch (const std::exception&e) {core_err << e.what();}
+        try { server = new udp_server(address, port); } catch (const std::exception&e) {core_err << e.what(); return;}
         server_initialized = true;
     }
 
@@ -492,6 +616,29 @@ namespace QhmSockets
         client->send(buf.data(), buf.size());
     }
 
+/** \brief Send a datagram to an arbitrary, already resolved, destination.
+ *
+ * A bound socket sends from its own address, so that the peer sees the
+ * endpoint it should reply to; an unbound one lazily opens a single
+ * unconnected socket and reuses it for every destination.
+ *
+ * \return -1 if an error occurs, otherwise the number of bytes sent.
+ */
+    int Socket::send_to(const char *buf, size_t len, const SockAddr &dst) {
+        core_assert(dst.valid(), return -1);
+        int fd = server_initialized ? server->get_socket() : unconnected_fd(dst.storage.ss_family);
+        core_assert(fd != -1, return -1);
+        return (int) sendto(fd, buf, len, 0, dst.addr(), dst.len);
+    }
+
+    int Socket::unconnected_fd(int family) {
+        if (send_fd != -1 && send_family == family) return send_fd;
+        if (send_fd != -1) ::close(send_fd);
+        send_fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+        send_family = family;
+        return send_fd;
+    }
+
     bool Socket::parse_endpoint(const std::string &endpoint) {
         std::vector<std::string> tokens;
         if (endpoint.substr(0,7) == "http://" )
@@ -510,6 +657,7 @@ namespace QhmSockets
     Socket::~Socket() {
         if(server_initialized) delete server;
         if(client_initialized) delete client;
+        if(send_fd != -1) ::close(send_fd);
     }
 
     void Socket::close() {
@@ -517,7 +665,14 @@ namespace QhmSockets
     }
 
     std::string Socket::sender_endpoint() const {
-        return  sender;
+        return  address_string(sender);
+    }
+
+    const SockAddr& Socket::sender_address() const {
+        return sender;
+    }
+    int64_t Socket::arrival_time() const {
+        return arrival;
     }
     bool Socket::is_bound() const {
         return server_initialized;
@@ -525,13 +680,15 @@ namespace QhmSockets
 
     int Message::recv(Socket &socket) {
         buffer = socket.recv();
-        sender = socket.sender_endpoint();
+        sender = socket.sender_address();
+        arrival = socket.arrival_time();
         return buffer.empty() ? 0 : 1;
     }
 
     int Message::recv(Socket &socket, int timeout) {
         buffer = socket.recv(timeout);
-        sender = socket.sender_endpoint();
+        sender = socket.sender_address();
+        arrival = socket.arrival_time();
         return buffer.empty() ? 0 : 1;
     }
 
@@ -551,6 +708,10 @@ namespace QhmSockets
         return socket.send(buffer);
     }
 
+    int Message::send_to(Socket &socket, const SockAddr &dst) const {
+        return socket.send_to(buffer.data(), buffer.size(), dst);
+    }
+
     std::string Message::str() const {
         return buffer;
     }
@@ -564,9 +725,17 @@ namespace QhmSockets
     }
 
     std::string Message::sender_ip() const {
+        return address_string(sender);
+    }
+
+    const SockAddr& Message::source() const {
         return sender;
     }
 
+    int64_t Message::arrival_time() const {
+        return arrival;
+    }
+
 } // namespace udp
 
 // vim: ts=4 sw=4 et
\ No newline at end of file
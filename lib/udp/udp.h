@@ -34,6 +34,7 @@ namespace QhmSockets
 {
 
 #define BUFFER_LEN  65535
+#define MTU_BUFFER_LEN 1472     // the UDP payload of a 1500 byte Ethernet frame
 #define RCVTIMEO    1
 #define SNDTIMEO    2
 
@@ -43,6 +44,20 @@ const static std::string ECHO_PKT =
 const static std::string ECHO_REPLY =
             R"(::::::::::::::::::::::::UDP_ECHO_REPLY::::::::::::::::::::::::)";
 
+    /* a resolved destination, ready to be handed to sendto() */
+    struct SockAddr {
+        struct sockaddr_storage     storage;
+        socklen_t                   len = 0;
+        bool                        valid() const { return len > 0; }
+        const struct sockaddr*      addr() const { return (const struct sockaddr*) &storage; }
+    };
+
+    bool                split_endpoint(const std::string& endpoint, std::string* host, int* port);
+    bool                resolve_address(const std::string& host, int port, SockAddr* out);
+    bool                resolve_endpoint(const std::string& endpoint, SockAddr* out);
+    bool                same_address(const SockAddr& addr, const std::string& host, int port);
+    std::string         address_string(const SockAddr& addr);
+
     class udp_client_server_runtime_error : public std::runtime_error
     {
     public:
@@ -70,7 +85,7 @@ const static std::string ECHO_REPLY =
         std::string         f_addr;
         std::string         o_addr;
 
-        struct addrinfo *   f_addrinfo;
+        SockAddr            f_address;
     };
 
 
@@ -86,14 +101,17 @@ const static std::string ECHO_REPLY =
 
         int                 recv(char *msg, size_t max_size);
         int                 timed_recv(char *msg, size_t max_size, int max_wait_ms);
-        int                 timed_recvfrom(char *msg, size_t max_size, int max_wait_ms, sockaddr* addr, socklen_t* len);
+        int                 timed_recvfrom(char *msg, size_t max_size, int max_wait_ms, sockaddr* addr, socklen_t* len,
+                                           int64_t* arrival = nullptr);
+        int                 timed_recvmsg(struct iovec* iov, size_t iovcnt, int max_wait_ms, sockaddr* addr,
+                                          socklen_t* len, int64_t* arrival = nullptr);
 
 
     private:
         int                 f_socket;
         int                 f_port;
         std::string         f_addr;
-        struct addrinfo *   f_addrinfo;
+        SockAddr            f_address;
     };
 
     class Socket {
@@ -111,19 +129,26 @@ const static std::string ECHO_REPLY =
         std::string recv();
         std::string recv(int timeout);
         void send(const std::string& buf);
+        int send_to(const char* buf, size_t len, const SockAddr& dst);
         std::string sender_endpoint() const;
+        const SockAddr& sender_address() const;
+        int64_t arrival_time() const;
 
     private:
         bool                parse_endpoint(const std::string& endpoint);
+        int                 unconnected_fd(int family);
+        std::string         receive(int timeout);
         std::string         address;
         int                 port;
-        udp_server*         server;
-        udp_client*         client;
+        udp_server*         server = nullptr;
+        udp_client*         client = nullptr;
+        int                 send_fd = -1;
+        int                 send_family = AF_UNSPEC;
         bool                server_initialized = false;
         bool                client_initialized = false;
         std::map<int,int>   options;
-        char                buffer[65535];
-        std::string         sender;
+        SockAddr            sender;
+        int64_t             arrival = 0;    // usec since the epoch the kernel received the last datagram at
         std::string         advertised_ip;
     };
 
@@ -134,16 +159,20 @@ const static std::string ECHO_REPLY =
         int                 recv(Socket& socket);
         int                 recv(Socket &socket, int timeout);
         void                send(Socket& socket) const;
+        int                 send_to(Socket& socket, const SockAddr& dst) const;
         void                rebuild(const void* data, size_t len);
         void                rebuild(const std::string& in);
         void *              data() const;
         size_t              size() const;
         std::string         str() const;
         std::string         sender_ip() const;
+        const SockAddr&     source() const;
+        int64_t             arrival_time() const;
         bool                empty() const;
     private:
         std::string         buffer;
-        std::string         sender;
+        SockAddr            sender;
+        int64_t             arrival = 0;
     };
 
     typedef Message multipart_t;
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include "load.h"
+
+struct LoadClient {
+    QhmSockets::Socket      socket;
+    http::Request           request;        // with its application-src, the procid changes on every send
+};
+
+struct Pending {
+    c_time_t                due;
+    c_time_t                sent;
+};
+
+/* what a generating thread counts, merged once it is done */
+struct LoadTally {
+    uint64_t                sent = 0;
+    uint64_t                replies = 0;
+    uint64_t                errors = 0;
+    uint64_t                timeouts = 0;
+    int64_t                 max_latency = 0;
+    int64_t                 max_service = 0;
+};
+
+struct LoadHistograms {
+    std::unique_ptr<metrics::Histogram> latency { new metrics::Histogram() };
+    std::unique_ptr<metrics::Histogram> service { new metrics::Histogram() };
+};
+
+static std::string _procid(int thread, uint64_t seq) {
+    return "load-" + std::to_string(thread) + "-" + std::to_string(seq);
+}
+
+static bool _seq(const std::string& procid, uint64_t* seq) {
+    auto dash = procid.rfind('-');
+    if(procid.compare(0, 5, "load-") != 0 || dash == std::string::npos) return false;
+    char* end = nullptr;
+    *seq = strtoull(procid.c_str() + dash + 1, &end, 10);
+    return *end == '\0';
+}
+
+/* the k-th request of thread i of n is due at start + (i + k * n) / rate: the threads interleave into one schedule */
+static void _generate(const LoadOptions& options, int index, std::vector<std::unique_ptr<LoadClient>>& clients,
+                      const QhmSockets::SockAddr& dest, c_time_t start, LoadHistograms& histograms, LoadTally& tally) {
+    const double spacing = 1e6 / options.rate;
+    const c_time_t end = start + (c_time_t) (options.duration * 1e6);
+    const c_time_t timeout = (c_time_t) options.timeout * 1000;
+    std::map<uint64_t, Pending> pending;
+    uint64_t seq = 0;
+    size_t next_client = 0;
+
+    auto due_of = [&](uint64_t k) { return start + (c_time_t) ((index + (double) k * options.threads) * spacing); };
+    auto receive = [&]() {
+        bool any = false;
+        for(auto& client: clients) {
+            for(std::string data = client->socket.recv(0); !data.empty(); data = client->socket.recv(0)) {
+                any = true;
+                c_time_t at = client->socket.arrival_time() ? client->socket.arrival_time() : time_now();
+                std::string procid;
+                uint64_t k;
+                if(!http::peek_header(data.data(), data.size(), HEADER_KEY_PROCEDURE_ID, &procid)
+                   || !_seq(procid, &k)) continue;
+                auto request = pending.find(k);
+                if(request == pending.end()) continue;      // already given up on
+
+                auto response = http::parse_response(data);
+                if(response.success && response.status / 100 == 2) {
+                    tally.replies++;
+                    int64_t latency = at - request->second.due, service = at - request->second.sent;
+                    histograms.latency->record(latency);
+                    histograms.service->record(service);
+                    tally.max_latency = std::max(tally.max_latency, latency);
+                    tally.max_service = std::max(tally.max_service, service);
+                } else tally.errors++;
+                pending.erase(request);
+            }
+        }
+        return any;
+    };
+    auto expire = [&](c_time_t now) {
+        while(!pending.empty() && pending.begin()->second.sent + timeout < now) {
+            tally.timeouts++;
+            pending.erase(pending.begin());
+        }
+    };
+
+    for(c_time_t due = due_of(seq); due < end; ) {
+        c_time_t now = time_now();
+        if(now >= due) {
+            // late or not, it goes now: a late request is charged from the time it was due
+            auto& client = *clients[next_client++ % clients.size()];
+            client.request.headers[HEADER_KEY_PROCEDURE_ID] = _procid(index, seq);
+            auto wire = http::serialize(&client.request);
+            c_time_t sent = time_now();
+            if(client.socket.send_to(wire.data(), wire.size(), dest) > 0) {
+                pending[seq] = {due, sent};
+                tally.sent++;
+            }
+            due = due_of(++seq);
+            continue;
+        }
+        if(!receive()) {
+            expire(now);
+            if(due - now > 100) usleep((useconds_t) std::min<c_time_t>(due - now - 50, 500));
+        }
+    }
+
+    c_time_t linger = time_now() + timeout;
+    for(c_time_t now = time_now(); !pending.empty() && now < linger; now = time_now())
+        if(!receive()) usleep(50);
+    tally.timeouts += pending.size();
+}
+
+LoadResult run_load(const LoadOptions& options) {
+    LoadResult result;
+    result.offered = options.rate;
+    QhmSockets::SockAddr dest;
+    core_assert(options.rate > 0 && options.duration > 0 && options.threads > 0
+                && options.clients >= options.threads, core_err << "[load] invalid options"; return result;);
+    core_assert(QhmSockets::resolve_endpoint(options.target, &dest),
+                core_err << "[load] cannot resolve " << options.target; return result;);
+
+    std::vector<std::vector<std::unique_ptr<LoadClient>>> clients(options.threads);
+    for(int c = 0; c < options.clients; c++) {
+        std::unique_ptr<LoadClient> client(new LoadClient());
+        std::string local_endpoint;
+        int port = _random_endpoint(client->socket, options.ip, local_endpoint);
+        core_assert(port, core_err << "[load] cannot find a port to bind to on " << options.ip; return result;);
+        client->request.method = HTTP_GET;
+        client->request.path = options.path;
+        client->request.body = options.body;
+        client->request.headers[HEADER_KEY_SERVICE_DST] = serialize_qhm_endpoint({"", 1, "null"});
+        client->request.headers[HEADER_KEY_SERVICE_SRC] = serialize_qhm_endpoint({options.ip, port, "load_client"});
+        clients[c % options.threads].push_back(std::move(client));
+    }
+
+    LoadHistograms histograms;
+    std::vector<LoadTally> tallies(options.threads);
+    std::vector<std::thread> threads;
+    c_time_t start = time_now() + 10000;        // leaves the threads time to start
+    for(int t = 0; t < options.threads; t++)
+        threads.emplace_back([&, t]() {
+            _generate(options, t, clients[t], dest, start, histograms, tallies[t]);
+        });
+    for(auto& t: threads) t.join();
+
+    result.elapsed = options.duration;
+    for(auto& tally: tallies) {
+        result.sent += tally.sent;
+        result.replies += tally.replies;
+        result.errors += tally.errors;
+        result.timeouts += tally.timeouts;
+        result.max_latency = std::max(result.max_latency, tally.max_latency);
+        result.max_service = std::max(result.max_service, tally.max_service);
+    }
+    result.latency = histograms.latency->snapshot();
+    result.service = histograms.service->snapshot();
+    return result;
+}
+
+std::vector<LoadResult> sweep_load(const LoadOptions& options, const std::vector<double>& rates) {
+    std::vector<LoadResult> results;
+    for(auto rate: rates) {
+        LoadOptions step = options;
+        step.rate = rate;
+        results.push_back(run_load(step));
+    }
+    return results;
+}
+
+int saturation_knee(const std::vector<LoadResult>& results) {
+    if(results.empty()) return -1;
+    int64_t baseline = results.front().latency.percentile(0.99);
+    int knee = -1;
+    for(size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        if(r.throughput() < 0.95 * r.offered || r.latency.percentile(0.99) > 10 * std::max<int64_t>(baseline, 1))
+            break;
+        knee = (int) i;
+    }
+    return knee;
+}
@@ -0,0 +1,50 @@
+#ifndef QHM_LOAD_H
+#define QHM_LOAD_H
+
+#include <string>
+#include <vector>
+#include "core/metrics.h"
+#include "messenger/messenger.h"
+
+/* open loop load: requests leave on a fixed schedule whether or not the previous ones were answered, as they do
+ * from many independent clients in production. Latency is measured from the time a request was due, not from when
+ * it actually left, so a generator that falls behind a slow service still charges the wait to the service
+ * (coordinated omission). Time from the actual send is reported next to it as service time. Replies are matched to
+ * requests by their application-procid. */
+struct LoadOptions {
+    SockEndpoint            target;
+    std::string             path = "/api/v1/ping";
+    std::string             body;
+    double                  rate = 1000;            // offered requests per second, over all the clients
+    double                  duration = 10;          // seconds
+    int                     clients = 16;           // sockets, each with its own port for replies
+    int                     threads = 2;            // clients are split among them
+    IpAddress               ip = "127.0.0.1";       // the clients bind here
+    int                     timeout = 1000;         // ms, a request unanswered for longer is lost
+};
+
+struct LoadResult {
+    double                  offered = 0;            // requests per second
+    double                  elapsed = 0;            // seconds, from the first request due to the last
+    uint64_t                sent = 0;
+    uint64_t                replies = 0;            // 2xx
+    uint64_t                errors = 0;             // other statuses, rejections included
+    uint64_t                timeouts = 0;
+    metrics::HistogramSnapshot  latency;            // usec from the time due, corrected
+    metrics::HistogramSnapshot  service;            // usec from the time sent
+    int64_t                 max_latency = 0;
+    int64_t                 max_service = 0;
+
+    double                  throughput() const { return elapsed > 0 ? replies / elapsed : 0; }
+};
+
+LoadResult                  run_load(const LoadOptions& options);
+
+/* a run per rate, as many as the rates given */
+std::vector<LoadResult>     sweep_load(const LoadOptions& options, const std::vector<double>& rates);
+
+/* the last run still keeping up: 95% of the offered rate answered and a p99 within ten times the one at the lowest
+ * rate. -1 when none does */
+int                         saturation_knee(const std::vector<LoadResult>& results);
+
+#endif //QHM_LOAD_H
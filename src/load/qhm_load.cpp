@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <cstdlib>
+#include "load.h"
+
+/* what the service measured per route and stage while it was loaded */
+static void print_counters(const LoadOptions& options) {
+    auto& target = options.target.str();
+    auto colon = target.rfind(':');
+    QhmEndpoint service = {target.substr(0, colon), atoi(target.c_str() + colon + 1), "target"};
+    http::Request request;
+    request.path = "/perf";
+    request.method = HTTP_GET;
+    auto response = sync_send_request(&request, {options.ip, 0, "load_client"}, service, options.timeout);
+    core_assert(response.status == HTTP_STATUS_OK, core_warn << "[load] no counters from " << options.target; return;);
+    printf("\n%s", response.body.c_str());
+}
+
+static int usage(const char* self) {
+    core_err << "usage: " << self << " <ip:port> [--path <url>] [--body <text>] [--rate <req/s>] [--duration <s>]\n"
+             << "       [--clients <n>] [--threads <n>] [--ip <ip>] [--timeout <ms>] [--sweep <from:to:step>]\n"
+             << "       [--perf]\n"
+             << "  requests leave at the offered rate whether or not they are answered; latency is counted from\n"
+             << "  the time each one was due. --sweep runs once per rate and reports where the service saturates,\n"
+             << "  --perf prints the counters per stage of a service running with perf_counters";
+    return 1;
+}
+
+static bool parse_sweep(const std::string& arg, std::vector<double>* rates) {
+    double from, to, step;
+    if(sscanf(arg.c_str(), "%lf:%lf:%lf", &from, &to, &step) != 3 || from <= 0 || step <= 0 || to < from) return false;
+    for(double rate = from; rate <= to + step / 2; rate += step) rates->push_back(rate);
+    return true;
+}
+
+static double ms(int64_t usec) { return usec / 1000.0; }
+
+static void print_header() {
+    printf("%10s %10s %9s %9s %9s %9s %9s %9s %9s %8s %8s\n", "offered/s", "replies/s", "p50 ms", "p90 ms", "p99 ms",
+           "p99.9 ms", "max ms", "svc p99", "svc max", "errors", "lost");
+}
+
+static void print_result(const LoadResult& r) {
+    printf("%10.0f %10.0f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %8llu %8llu\n", r.offered, r.throughput(),
+           ms(r.latency.percentile(0.5)), ms(r.latency.percentile(0.9)), ms(r.latency.percentile(0.99)),
+           ms(r.latency.percentile(0.999)), ms(r.max_latency), ms(r.service.percentile(0.99)), ms(r.max_service),
+           (unsigned long long) r.errors, (unsigned long long) r.timeouts);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) return usage(argv[0]);
+
+    LoadOptions options;
+    options.target = argv[1];
+    std::vector<double> rates;
+    bool counters = false;
+    for(int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--perf") { counters = true; continue; }
+        if(i + 1 >= argc) return usage(argv[0]);
+        if(arg == "--path") options.path = argv[++i];
+        else if(arg == "--body") options.body = argv[++i];
+        else if(arg == "--rate") options.rate = atof(argv[++i]);
+        else if(arg == "--duration") options.duration = atof(argv[++i]);
+        else if(arg == "--clients") options.clients = atoi(argv[++i]);
+        else if(arg == "--threads") options.threads = atoi(argv[++i]);
+        else if(arg == "--ip") options.ip = argv[++i];
+        else if(arg == "--timeout") options.timeout = atoi(argv[++i]);
+        else if(arg == "--sweep") { if(!parse_sweep(argv[++i], &rates)) return usage(argv[0]); }
+        else return usage(argv[0]);
+    }
+    if(rates.empty()) rates.push_back(options.rate);
+
+    // percentiles are bucket upper bounds, within ~6% of the exact value; the maxima are exact
+    print_header();
+    std::vector<LoadResult> results;
+    for(auto rate: rates) {
+        results.push_back(sweep_load(options, {rate}).front());
+        print_result(results.back());
+    }
+
+    if(results.size() > 1) {
+        int knee = saturation_knee(results);
+        if(knee < 0) printf("saturated already at %.0f req/s\n", results.front().offered);
+        else if(knee + 1 == (int) results.size()) printf("not saturated up to %.0f req/s\n", results.back().offered);
+        else printf("saturation knee between %.0f and %.0f req/s\n", results[knee].offered,
+                    results[knee + 1].offered);
+    }
+    if(counters) print_counters(options);
+    for(auto& r: results) if(!r.sent) return 1;
+    return 0;
+}
@@ -3,6 +3,7 @@
 //
 
 #include <zconf.h>
+#include <algorithm>
 #include "json/single_include/nlohmann/json.hpp"
 #include "messenger/messenger.h"
 
@@ -19,6 +20,55 @@ DECLARE_MESSAGE_HANDLER(terminate_handler, req, rep, ctx) {
     return CORE_CONTINUE;
 }
 
+DECLARE_ROUTE_HANDLER(metrics_handler, in, out, params, ctx) {
+    *out = reply_back(in);
+    auto labels = metrics::labels({{"service", ctx->node_self->tag()}});
+    std::ostringstream local;
+    // what only this worker knows, next to the process-wide registry
+    local << "# TYPE qhm_shed_total counter\nqhm_shed_total{" << labels << "} " << ctx->admission.shed << "\n"
+          << "# TYPE qhm_expired_total counter\nqhm_expired_total{" << labels << "} " << ctx->admission.expired << "\n"
+          << "# TYPE qhm_response_cache_hits_total counter\nqhm_response_cache_hits_total{" << labels << "} "
+          << ctx->response_cache.hits << "\n"
+          << "# TYPE qhm_response_cache_misses_total counter\nqhm_response_cache_misses_total{" << labels << "} "
+          << ctx->response_cache.misses << "\n"
+          << "# TYPE qhm_idempotency_hits_total counter\nqhm_idempotency_hits_total{" << labels << "} "
+          << ctx->idempotency.hits << "\n"
+          << "# TYPE qhm_log_dropped_lines_total counter\nqhm_log_dropped_lines_total " << log_dropped() << "\n";
+    (*out)->body = metrics::registry().prometheus() + local.str();
+    (*out)->headers["content-type"] = "text/plain; version=0.0.4";
+    __as_response(*out)->status = HTTP_STATUS_OK;
+    return CORE_OK;
+}
+
+DECLARE_ROUTE_HANDLER(trace_handler, in, out, params, ctx) {
+    *out = reply_back(in);
+    // ?limit=<n> for the n most recent spans; fewer still if they would not fit the reply datagram
+    size_t limit = 0;
+    core_try(limit = std::stoul(params.at("trace").at("params").at("limit").get<std::string>()), );
+    (*out)->body = trace::chrome_json(limit, TRACE_EXPORT_MAX_BYTES);
+    (*out)->headers["content-type"] = "application/json";
+    __as_response(*out)->status = HTTP_STATUS_OK;
+    return CORE_OK;
+}
+
+DECLARE_ROUTE_HANDLER(perf_handler, in, out, params, ctx) {
+    *out = reply_back(in);
+    (*out)->body = perf::report();
+    (*out)->headers["content-type"] = "text/plain";
+    __as_response(*out)->status = HTTP_STATUS_OK;
+    return CORE_OK;
+}
+
+TransactionMetrics transaction_metrics(const NodeTag& service, const std::string& key, const std::string& value) {
+    auto labels = metrics::labels({{"service", service}, {key, value}});
+    TransactionMetrics m;
+    m.transactions = metrics::registry().counter("qhm_transactions_total", labels);
+    m.errors = metrics::registry().counter("qhm_transaction_errors_total", labels);
+    m.latency = metrics::registry().histogram("qhm_transaction_latency_microseconds", labels);
+    m.label = value;
+    return m;
+}
+
 DECLARE_EVENT_HANDLER(delete_node, params, ctx){
     core_assert(params.type() == nlohmann::json::value_t::array, return CORE_CONTINUE;);
     for(auto && el : params){
@@ -37,17 +87,86 @@ Messenger::Messenger(Configuration p) {
 }
 
 Status Messenger::init() {
-    rtr_socket->bind(node_self.endpoint);
+    rtr_socket->bind(node_self.endpoint());
 
     register_msg_handler(SERVICE_TERMINATE, &terminate_handler);
     register_evt_handler(DELETE_NODE, &delete_node);
 
     if (!context) context = std::make_shared<MessengerContext>(MessengerContext());
+    context->router.add_route("/metrics", &metrics_handler);
+    context->router.add_route("/trace", &trace_handler);
+    context->router.add_route("/perf", &perf_handler);
+    auto service = metrics::labels({{"service", node_self.tag()}});
+    context->queue_depth = metrics::registry().gauge("qhm_ingress_queue_depth", service);
+    context->in_flight = metrics::registry().gauge("qhm_in_flight_transactions", service);
+    context->unrouted_metrics = transaction_metrics(node_self.tag(), "route", "unrouted");
+    context->replayed_metrics = transaction_metrics(node_self.tag(), "route", "replayed");
     context->should_run = true;
     context->node_self = &node_self;
+    context->socket = rtr_socket;
 
     auto verbose = configuration.safe_at("verbose");
     if(!verbose.empty()) context->verbose = (verbose == "true");
+    auto verbose_sample = configuration.safe_at(CONFIG_KEY_VERBOSE_SAMPLE);
+    if(!verbose_sample.empty())
+        core_try(context->dump_sampler.every = std::stoull(verbose_sample), );
+
+    auto tracing = configuration.safe_at(CONFIG_KEY_TRACE);
+    if(!tracing.empty()) trace::enable(tracing == "true");
+    auto perf_counters = configuration.safe_at(CONFIG_KEY_PERF_COUNTERS);
+    if(perf_counters == "true")
+        core_assert(perf::enable(true), core_warn << "no performance counter can be opened, see perf_event_paranoid";);
+
+    QhmSockets::resolve_endpoint(node_self.endpoint(), &context->self_address);
+    auto capture_file = configuration.safe_at(CONFIG_KEY_CAPTURE_FILE);
+    if(!capture_file.empty()) {
+        context->capture.reset(new QhmSockets::CaptureWriter());
+        core_assert(context->capture->open(capture_file),
+                    core_warn << "cannot capture to " << capture_file; context->capture.reset(););
+    }
+    auto flight_recorder = configuration.safe_at(CONFIG_KEY_FLIGHT_RECORDER);
+    if(!flight_recorder.empty())
+        core_try(context->flight_recorder.resize(std::stoul(flight_recorder)), );
+    auto flight_recorder_dir = configuration.safe_at(CONFIG_KEY_FLIGHT_RECORDER_DIR);
+    if(!flight_recorder_dir.empty()) context->flight_recorder_dir = flight_recorder_dir;
+    context->flight_recorder_dumps = install_flight_recorder_signal();
+
+    auto log_file = configuration.safe_at(CONFIG_KEY_LOG_FILE);
+    if(!log_file.empty())
+        core_assert(log_to_file(log_file), core_warn << "cannot log to " << log_file << ", staying on stdout";);
+
+    auto ephemeral_ttl = configuration.safe_at(CONFIG_KEY_EPHEMERAL_TTL);
+    if(!ephemeral_ttl.empty())
+        core_try(context->ephemeral_peer_ttl = std::stoll(ephemeral_ttl) * 1000, );
+
+    auto idempotency_ttl = configuration.safe_at(CONFIG_KEY_IDEMPOTENCY_TTL);
+    if(!idempotency_ttl.empty())
+        core_try(context->idempotency.ttl = std::stoll(idempotency_ttl) * 1000, );
+    auto idempotency_capacity = configuration.safe_at(CONFIG_KEY_IDEMPOTENCY_CAPACITY);
+    if(!idempotency_capacity.empty())
+        core_try(context->idempotency.capacity = std::stoul(idempotency_capacity), );
+
+    auto& admission = context->admission;
+    auto queue_depth = configuration.safe_at(CONFIG_KEY_ADMISSION_QUEUE_DEPTH);
+    if(!queue_depth.empty())
+        core_try(admission.queue_depth = std::stoul(queue_depth), );
+    auto queue_delay = configuration.safe_at(CONFIG_KEY_ADMISSION_QUEUE_DELAY);
+    if(!queue_delay.empty())
+        core_try(admission.queue_delay = std::stoll(queue_delay) * 1000, );
+    auto retry_after = configuration.safe_at(CONFIG_KEY_ADMISSION_RETRY_AFTER);
+    if(!retry_after.empty())
+        core_try(admission.retry_after = std::stoi(retry_after), );
+
+    auto response_cache_bytes = configuration.safe_at(CONFIG_KEY_RESPONSE_CACHE_BYTES);
+    if(!response_cache_bytes.empty())
+        core_try(context->response_cache.capacity = std::stoul(response_cache_bytes), );
+
+    // the rejection is serialized once, shedding only splices the requester in
+    http::Response rejection;
+    rejection.status = HTTP_STATUS_SERVICE_UNAVAILABLE;
+    rejection.headers[HEADER_KEY_SERVICE_SRC] = serialize_qhm_endpoint(node_self);
+    rejection.headers[HEADER_KEY_RETRY_AFTER] = std::to_string(admission.retry_after);
+    admission.rejection = http::serialize(&rejection);
 
     return CORE_OK;
 }
@@ -57,53 +176,185 @@ Status Messenger::after_init() {
 }
 
 Status Messenger::finalize() {
-    rtr_socket->unbind(node_self.endpoint);
+    if(context->capture) context->capture->close();
+    rtr_socket->unbind(node_self.endpoint());
     delete rtr_socket;
 
-    for(auto&& node: context->known_nodes) delete node.second;
+    for(auto&& group: context->known_nodes)
+        for(auto node: group.second.members) delete node;
 
     return CORE_OK;
 }
 
+// a 5xx reply, told from its status line alone
+static inline bool is_server_error(const Message& m) {
+    return m.size() > 9 && ((const char*) m.data())[9] == '5';
+}
+
 void Messenger::run() {
     core_assert(init() == CORE_OK, return);
     core_assert(context, core_err << "context not initialized"; return;);
     core_assert(after_init() == CORE_OK, return);
+    trace::name_thread(node_self.tag());
     Status rv;
-    Message request, reply, event;
+    Message reply, event;
     QhmEndpoint dest;
 
     while (context->should_run) {
+        dump_flight_recorder();
         if (!context->event_queue.empty())
             if(process_event() == CORE_TERMINATE) break;
 
-        if (!request.recv(*rtr_socket, timeout)) continue;
+        if (!receive()) continue;
+
+        IngressMessage request = std::move(context->ingress.front());
+        context->ingress.pop_front();
+        context->queue_depth->set(context->ingress.size());
+        if (!admit(request)) continue;
 
-        rv = process_message(request, &reply, &dest);
+        context->in_flight->set(context->ingress.size() + 1);
+        served = nullptr;
 
-        if(rv < CORE_OK) { rv = error(context.get(), &reply, dest.tag, HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        // continues the trace of the caller, if it sent one
+        std::string trace_context;
+        if (trace::enabled())
+            http::peek_header(request.message.data(), request.message.size(), HEADER_KEY_TRACE, &trace_context);
+        trace::Span transaction("transaction", trace::parse(trace_context));
+
+        // nested requests issued by the handler inherit the deadline
+        set_request_deadline(request.deadline);
+        rv = process_message(request.message, &reply, &dest);
+        set_request_deadline(0);
+
+        bool failed = rv < CORE_OK;
+        if(failed) { rv = error(context.get(), &reply, dest, HTTP_STATUS_INTERNAL_SERVER_ERROR);
             core_assert(rv == CORE_OK, continue;); }
 
-        if (rv == CORE_OK) transaction_commit(context.get(), reply, dest);
+        if (rv == CORE_OK) {
+            trace::Span commit("transaction_commit");
+            perf::Stage counters("transaction_commit");
+            transaction_commit(context.get(), reply, dest, &request.message.source());
+        }
+
+        if (served) {
+            served->transactions->inc();
+            if (failed || (rv == CORE_OK && is_server_error(reply))) served->errors->inc();
+            served->latency->record(time_now() - request.received);
+        }
+        if (perf::enabled()) perf::commit(served ? served->label : "");
+        context->in_flight->set(context->ingress.size());
     }
 
     core_assert(finalize() == CORE_OK, return);
 }
 
+/* completes a reply serialized without the headers that depend on the requester and on the moment */
+static std::string splice_reply(const std::string& reply, const std::string& dst, const std::string& procid,
+                                size_t load) {
+    std::string headers = HEADER_KEY_SERVICE_DST + ": " + dst + "\n"
+                          + HEADER_KEY_LOAD + ": " + std::to_string(load) + "\n";
+    if(!procid.empty()) headers += HEADER_KEY_PROCEDURE_ID + ": " + procid + "\n";
+    return std::string(reply).insert(reply.find('\n') + 1, headers);
+}
+
+// control messages, those of the types the messenger reserves for itself (e.g. SERVICE_TERMINATE), are never shed
+static inline bool is_control_message(const Message& m) {
+    std::string type;
+    if(!http::peek_header(m.data(), m.size(), HEADER_KEY_APP_MESSAGETYPE, &type) || type.empty()) return false;
+    char* end;
+    auto value = strtoul(type.c_str(), &end, 10);
+    return *end == '\0' && event_strings.count(value);
+}
+
+// when the kernel received it, so that time queued in the socket counts too
+static inline c_time_t arrival(const Message& m) {
+    return m.arrival_time() ? m.arrival_time() : time_now();
+}
+
+bool Messenger::receive() {
+    auto& queue = context->ingress;
+    auto& admission = context->admission;
+    IngressMessage ingress;
+
+    if (queue.empty()) {
+        if (!ingress.message.recv(*rtr_socket, timeout)) return false;
+        observe(ingress.message);
+        ingress.received = arrival(ingress.message);
+        queue.push_back(std::move(ingress));
+    }
+
+    // take in what the kernel already holds, so that the excess is refused now instead of dropped or served stale.
+    // At most queue_depth rejections per pass, a flood must not keep the worker from the work it admitted
+    size_t rejected = 0;
+    while (rejected < admission.queue_depth && ingress.message.recv(*rtr_socket, 0)) {
+        observe(ingress.message);
+        ingress.received = arrival(ingress.message);
+        if (queue.size() < admission.queue_depth || is_control_message(ingress.message))
+            queue.push_back(std::move(ingress));
+        else {
+            shed(ingress);
+            rejected++;
+        }
+    }
+
+    return true;
+}
+
+bool Messenger::admit(IngressMessage &ingress) {
+    auto& admission = context->admission;
+    const Message& m = ingress.message;
+    c_time_t now = time_now();
+
+    // past its deadline the caller is not waiting anymore: the work would be wasted, the answer never read
+    std::string budget;
+    if (http::peek_header(m.data(), m.size(), HEADER_KEY_DEADLINE, &budget)) {
+        core_try(ingress.deadline = ingress.received + std::stoll(budget) * 1000, );
+        if (ingress.deadline && ingress.deadline <= now) {
+            admission.expired++;
+            if(context->verbose)
+                core_warn_tag(node_self.tag()) << "dropping request from " << m.sender_ip() << ", deadline expired";
+            return false;
+        }
+    }
+
+    if (admission.queue_delay <= 0 || now - ingress.received <= admission.queue_delay) return true;
+    if (is_control_message(ingress.message)) return true;
+    shed(ingress);
+    return false;
+}
+
+void Messenger::shed(const IngressMessage &ingress) {
+    auto& admission = context->admission;
+    const Message& m = ingress.message;
+    admission.shed++;
+
+    // only the start line and the routing headers are looked at: what is not an answerable request is dropped
+    std::string src, procid;
+    if (!http::peek_request(m.data(), m.size())
+        || !http::peek_header(m.data(), m.size(), HEADER_KEY_SERVICE_SRC, &src)) return;
+
+    http::peek_header(m.data(), m.size(), HEADER_KEY_PROCEDURE_ID, &procid);
+
+    if(context->verbose)
+        core_warn_tag(node_self.tag()) << "shedding request from " << m.sender_ip() << ", "
+                                     << context->ingress.size() << " queued";
+
+    Message reply(splice_reply(admission.rejection, src, procid, context->ingress.size()));
+    transaction_commit(context.get(), reply, parse_qhm_endpoint(src), &m.source());
+}
+
 Status Messenger::process_event() {
 
-    Event evt = context->event_queue.front();
+    const Event evt = std::move(context->event_queue.front());
     context->event_queue.pop();
 
     if(context->verbose)
-        core_ok_tag(node_self.tag) << "reacting to "<< evt.headers.at(HEADER_KEY_EVENT_TYPE) << " event";
+        core_debug_tag(node_self.tag()) << "reacting to " << evt.name() << " (" << evt.type << ") event";
 
-    auto event_type = (uint32_t) std::stoi(evt.headers.at(HEADER_KEY_EVENT_TYPE));
-
-    switch (event_type) {
+    switch (evt.type) {
         case SERVICE_TERMINATE: context->should_run = false; return CORE_TERMINATE;
         default: {
-            get_evt_handler((EventType) event_type) (context.get(), evt.params);
+            get_evt_handler(evt.type) (context.get(), evt.params());
             break;
         }
     }
@@ -120,26 +371,115 @@ Status Messenger::process_message(const Message &udp_message_in,
     http::Message *http_out = nullptr;
 
     if(context->verbose)
-        core_log_tag(node_self.tag) << "received msg from " << udp_message_in.sender_ip();
+        core_debug_tag(node_self.tag()) << "received msg from " << udp_message_in.sender_ip();
+
+    // a retried request that was already answered gets the same answer: only its headers are looked at
+    std::string procid, src;
+    if(http::peek_request(udp_message_in.data(), udp_message_in.size())
+       && http::peek_header(udp_message_in.data(), udp_message_in.size(), HEADER_KEY_PROCEDURE_ID, &procid)
+       && http::peek_header(udp_message_in.data(), udp_message_in.size(), HEADER_KEY_SERVICE_SRC, &src)
+       && context->idempotency.enabled()) {
+        auto cached = context->idempotency.find(src, procid);
+        if(cached) {
+            if(context->verbose) core_debug_tag(node_self.tag()) << "replaying reply to procedure " << procid;
+            served = &context->replayed_metrics;
+            udp_message_out->rebuild(cached->reply);
+            *dest = parse_qhm_endpoint(cached->dst);
+            return CORE_OK;
+        }
+    }
+
+    Route* route = nullptr;
+    std::string cache_key;
 
-    rv = parse_http(udp_message_in.data(), udp_message_in.size(), &http_in); // allocs http_in
+    {
+        trace::Span span("parse_http");
+        perf::Stage counters("parse_http");
+        rv = parse_http(udp_message_in.data(), udp_message_in.size(), &http_in); // allocs http_in
+    }
     core_assert(rv == CORE_OK, core_err << "error parsing \n" << udp_message_in.str() ;return CORE_GENERIC_ERROR;);
-    if(context->verbose)
-        core_log_tag(node_self.tag) << "received http:\n" << http::serialize(http_in);
+    // serializing the message again only to print it costs as much as the parse: dumps are sampled
+    if(context->verbose && context->dump_sampler.sample())
+        core_trace_tag(node_self.tag()) << "received http:\n" << http::serialize(http_in);
 
     if(headers_have(http_in->headers, HEADER_KEY_APP_MESSAGETYPE)){
         auto app_msgtype = (uint32_t) std::stoi(http_in->headers.at(HEADER_KEY_APP_MESSAGETYPE));
         if(context->verbose)
-            core_ok_tag(node_self.tag) << "received app message type " << app_msgtype_string(app_msgtype);
+            core_debug_tag(node_self.tag()) << "received app message type " << app_msgtype_string(app_msgtype);
+        auto type_metrics = context->message_metrics.find(app_msgtype);
+        if(type_metrics == context->message_metrics.end())
+            type_metrics = context->message_metrics.emplace(app_msgtype,
+                    transaction_metrics(node_self.tag(), "type", app_msgtype_string(app_msgtype))).first;
+        served = &type_metrics->second;
+        trace::Span span("handler");
+        perf::Stage counters("handler");
         rv = (get_message_handler(app_msgtype))(context.get(), http_in, &http_out); // allocs http_out
-    } else
-        rv = process_http(http_in, &http_out);
+    } else {
+        if(http_in->type == http::REQUEST) {
+            trace::Span span("route");
+            perf::Stage counters("route");
+            route = context->router.match(__as_request(http_in)->path);
+        }
+        if(route) {
+            if(!route->metrics.transactions)
+                route->metrics = transaction_metrics(node_self.tag(), "route", route->path);
+            served = &route->metrics;
+        } else
+            served = &context->unrouted_metrics;
+
+        // a cacheable GET answered recently: the stored reply only lacks who it goes to
+        if(route && route->cache.enabled() && __as_request(http_in)->method == HTTP_GET
+           && headers_have(http_in->headers, HEADER_KEY_SERVICE_SRC)) {
+            cache_key = response_cache_key(__as_request(http_in), route->cache);
+            auto cached = context->response_cache.find(cache_key);
+            if(cached) {
+                if(context->verbose)
+                    core_debug_tag(node_self.tag()) << "cached reply for " << __as_request(http_in)->path;
+                auto dst = http_in->headers.at(HEADER_KEY_SERVICE_SRC);
+                udp_message_out->rebuild(splice_reply(*cached, dst, procid, context->ingress.size()));
+                *dest = parse_qhm_endpoint(dst);
+                if(!procid.empty()) context->idempotency.store(src, procid, {udp_message_out->str(), dst});
+                http::http_free(http_in);
+                return CORE_OK;
+            }
+        }
+
+        rv = process_http(http_in, route, &http_out);
+    }
 
 #define cleanup http::http_free(http_out); http::http_free(http_in);
     if(rv != CORE_OK) {cleanup; return rv;}
 
-    udp_message_out->rebuild(http::serialize(http_out));
-    *dest = parse_qhm_endpoint(http_out->headers[HEADER_KEY_SERVICE_DST]);
+    if(!cache_key.empty() && http_out->type == http::RESPONSE && __as_response(http_out)->status == HTTP_STATUS_OK) {
+        // cached without the headers that depend on the requester and on the moment
+        auto dst = http_out->headers[HEADER_KEY_SERVICE_DST];
+        http_out->headers.erase(HEADER_KEY_SERVICE_DST);
+        http_out->headers.erase(HEADER_KEY_PROCEDURE_ID);
+        http_out->headers.erase(HEADER_KEY_LOAD);
+        trace::Span span("serialize");
+        perf::Stage counters("serialize");
+        std::string cacheable = http::serialize(http_out);
+        udp_message_out->rebuild(splice_reply(cacheable, dst, procid, context->ingress.size()));
+        context->response_cache.store(cache_key, cacheable, route->cache.ttl);
+        http_out->headers[HEADER_KEY_SERVICE_DST] = dst;
+    } else {
+        if(!procid.empty() && !headers_have(http_out->headers, HEADER_KEY_PROCEDURE_ID))
+            http_out->headers[HEADER_KEY_PROCEDURE_ID] = procid;
+        // piggybacked for the callers balancing across replicas: what is still waiting for this worker
+        if(http_out->type == http::RESPONSE && !headers_have(http_out->headers, HEADER_KEY_LOAD))
+            http_out->headers[HEADER_KEY_LOAD] = std::to_string(context->ingress.size());
+
+        trace::Span span("serialize");
+        perf::Stage counters("serialize");
+        udp_message_out->rebuild(http::serialize(http_out));
+    }
+    {
+        trace::Span span("parse_qhm_endpoint");
+        *dest = parse_qhm_endpoint(http_out->headers[HEADER_KEY_SERVICE_DST]);
+    }
+
+    if(!procid.empty())
+        context->idempotency.store(src, procid, {udp_message_out->str(), http_out->headers[HEADER_KEY_SERVICE_DST]});
 
     cleanup;
 #undef cleanup
@@ -147,16 +487,17 @@ Status Messenger::process_message(const Message &udp_message_in,
     return rv;
 }
 
-Status Messenger::process_http(http::Message* in, http::Message** out) {
+Status Messenger::process_http(http::Message* in, Route* route, http::Message** out) {
     using nlohmann::json;
 
     Status rv = CORE_OK;
     core_assert(in->type == http::REQUEST, return CORE_CONTINUE;);
     std::string requested_path = __as_request(in)->path;
 
-    // retrieve the handler and use it (and parse the path to get the params)
-    Route*  route = context->router.match(requested_path);
+    // use the handler of the matched route (and parse the path to get the params)
     if(route) {
+        trace::Span span("handler");
+        perf::Stage counters("handler");
         json params = parse_all_params_in_url(requested_path, route->params);
         rv = (*route->handler)(context.get(), params, in, out);
         core_assert(rv == CORE_OK, return CORE_GENERIC_ERROR;);
@@ -170,7 +511,7 @@ Status Messenger::process_http(http::Message* in, http::Message** out) {
 
     // validate the http message
     core_assert(validate_http_message(*out, msg_schema),
-                core_warn_tag(context->node_self->tag)
+                core_warn_tag(context->node_self->tag())
                         << "handler did not build valid http. Check handler for url " << __as_request(in)->path << "?";
                         return CORE_GENERIC_ERROR;
     );
@@ -180,7 +521,7 @@ Status Messenger::process_http(http::Message* in, http::Message** out) {
 
 MessageHandler Messenger::get_message_handler(ApplicationMessageType type) {
     core_assert(app_msg_handlers.find(type) != app_msg_handlers.end(),
-                core_warn_tag(node_self.tag) << "Can't handle message type: " << type;
+                core_warn_tag(node_self.tag()) << "Can't handle message type: " << type;
                         return &default_handler;
     );
     return app_msg_handlers[type];
@@ -188,7 +529,7 @@ MessageHandler Messenger::get_message_handler(ApplicationMessageType type) {
 
 EventHandler Messenger::get_evt_handler(EventType type) {
     core_assert(evt_handlers.find(type) != evt_handlers.end(),
-                core_warn_tag(node_self.tag) << "Can't handle event type: " << type;
+                core_warn_tag(node_self.tag()) << "Can't handle event type: " << type;
                         return nullptr;
     );
     return evt_handlers[type];
@@ -232,32 +573,43 @@ Status Messenger::deregister_evt_handler(EventType type) {
     return CORE_OK;
 }
 
-NeighbourNode* add_node(MessengerContext* context, const QhmEndpoint &new_node) {
+NeighbourNode* add_node(MessengerContext* context, const QhmEndpoint &new_node, int weight) {
     auto known_nodes = &context->known_nodes;
     auto node_self = context->node_self;
-    core_assert(known_nodes->find(new_node.tag) == known_nodes->end(),
-                core_warn_tag(new_node.tag) << " was already known"; return nullptr);
+    auto group = known_nodes->find(new_node.tag());
+    core_assert(group == known_nodes->end() || !group->second.find(new_node.endpoint()),
+                core_warn_tag(new_node.tag()) << " was already known"; return nullptr);
     if(context->verbose)
-        core_ok_tag(node_self->tag) << "adding node "<<  new_node.tag << ", connecting to " << new_node.endpoint;
+        core_debug_tag(node_self->tag()) << "adding node "<<  new_node.tag()
+                                         << ", connecting to " << new_node.endpoint();
 
-    auto newnode = new NeighbourNode(new_node, context->node_self->ip_address);
+    auto newnode = new NeighbourNode(new_node);
+    newnode->weight = std::max(weight, 1);
+    // known nodes are what the intern table is for: lookups of decoded tags and endpoints then compare pointers
+    newnode->intern();
 
-    core_assert(newnode->connected(),
-                core_err_tag(node_self->tag) << "could not connect to " << newnode->tag; return nullptr;);
+    core_assert(newnode->address.valid(),
+                core_err_tag(node_self->tag()) << "could not connect to " << newnode->tag();
+                delete newnode; return nullptr;);
 
-    (*known_nodes)[new_node.tag] = newnode;
+    (*known_nodes)[newnode->tag()].members.push_back(newnode);
 
-    if(context->verbose) core_ok_tag(node_self->tag) << "...connected!";
+    if(context->verbose) core_debug_tag(node_self->tag()) << "...connected!";
 
     return newnode;
 }
 
 Status del_node(MessengerContext* context, const QhmEndpoint &deleteme) {
     auto known_nodes = &context->known_nodes;
-    auto it = known_nodes->find(deleteme.tag);
+    auto it = known_nodes->find(deleteme.tag());
     core_assert(it != known_nodes->end(), return CORE_GENERIC_ERROR);
-    known_nodes->erase(it);
-    delete it->second;
+    auto& members = it->second.members;
+    auto node = std::find(members.begin(), members.end(), it->second.find(deleteme.endpoint()));
+    core_assert(node != members.end(), return CORE_GENERIC_ERROR);
+    delete *node;
+    members.erase(node);
+    if(members.empty()) known_nodes->erase(it);
+    return CORE_OK;
 }
 
 bool validate_http_message(const http::Message *msg, const HttpHeaderSchema &schema) {
@@ -278,34 +630,68 @@ bool validate_http_message(const http::Message *msg, const HttpHeaderSchema &sch
     return true;
 }
 
-void dispatch_event(MessengerContext *ctx, const Event &evt) {
-    ctx->event_queue.push(evt);
+/* pass an rvalue, or std::move it: the event is moved into the queue and out of it */
+void dispatch_event(MessengerContext *ctx, Event evt) {
+    ctx->event_queue.push(std::move(evt));
 }
 
-Status transaction_commit(MessengerContext* context, const Message &reply, const QhmEndpoint& dest) {
-    NeighbourNode * node = find_node_by_uri(dest.tag , &context->known_nodes, &node);
-    if(!node){
-        if(context->verbose) core_warn << dest.tag << " was unknown, adding it...";
-        node = add_node(context, dest);
-    }
+Status transaction_commit(MessengerContext* context, const Message &reply, const QhmEndpoint& dest,
+                          const QhmSockets::SockAddr* source) {
+    const QhmSockets::SockAddr* address = nullptr;
+    auto group = context->known_nodes.find(dest.tag());
+    NeighbourNode * node = group != context->known_nodes.end() ? group->second.find(dest.endpoint()) : nullptr;
+    if(node) address = &node->address;
+    // the peer replied to is the one that sent the datagram: no lookup at all
+    else if(source && QhmSockets::same_address(*source, dest.ip_address(), dest.port())) address = source;
+    else address = ephemeral_peer_address(context, dest);
+
+    core_assert(address, core_warn_tag(context->node_self->tag()) << "cannot reach " << dest.endpoint();
+            return CORE_GENERIC_ERROR;);
 
     if(context->verbose)
-        core_ok_tag(context->node_self->tag) << "sending "<< reply.size() << " bytes to "<< dest.tag.data();
+        core_debug_tag(context->node_self->tag()) << "sending "<< reply.size() << " bytes to "<< dest.tag().data();
+
+    reply.send_to(*context->socket, *address);
+
+    return CORE_OK;
+}
 
-    reply.send(*node->socket);
+const QhmSockets::SockAddr* ephemeral_peer_address(MessengerContext* context, const QhmEndpoint& peer) {
+    auto peers = &context->ephemeral_peers;
+    auto now = time_now();
 
-    if(node->tag.substr(0,5) == "temp_") {
-        Event evt(DELETE_NODE);
-        evt.params.push_back(serialize_qhm_endpoint(*node));
-        dispatch_event(context,evt);
+    auto it = peers->find(peer.endpoint());
+    if(it != peers->end() && it->second.expires > now) return &it->second.address;
+
+    EphemeralPeer& entry = (*peers)[peer.endpoint()];
+    if(!QhmSockets::resolve_address(peer.ip_address(), peer.port(), &entry.address)) {
+        peers->erase(peer.endpoint());
+        return nullptr;
+    }
+    entry.expires = now + context->ephemeral_peer_ttl;
+
+    // the expired ones go, then the oldest past the capacity. Peers cached again since leave a stale record behind,
+    // which must not evict the fresh entry
+    auto order = &context->ephemeral_order;
+    order->emplace_back(peer.endpoint(), entry.expires);
+    while(!order->empty() && (order->front().second <= now || peers->size() > EPHEMERAL_PEER_CAPACITY)) {
+        auto oldest = peers->find(order->front().first);
+        if(oldest != peers->end() && oldest->second.expires == order->front().second) peers->erase(oldest);
+        order->pop_front();
     }
 
-    return CORE_OK;
+    if(context->verbose)
+        core_debug_tag(context->node_self->tag()) << "caching ephemeral peer " << peer.tag()
+                                                  << " at " << peer.endpoint();
+
+    return &entry.address;
 }
 
-Status error(MessengerContext* context, Message *resp, const NodeTag& dest, uint32_t status) {
-    NeighbourNode * node = find_node_by_uri(dest , &context->known_nodes, &node);
-    core_assert(node, core_warn_tag(context->node_self->tag) << "node " << dest << " not found";
+Status error(MessengerContext* context, Message *resp, const QhmEndpoint& dest, uint32_t status) {
+    // the requester itself: by tag alone, any of the replicas sharing it could come back
+    auto group = context->known_nodes.find(dest.tag());
+    NeighbourNode * node = group != context->known_nodes.end() ? group->second.find(dest.endpoint()) : nullptr;
+    core_assert(node, core_warn_tag(context->node_self->tag()) << "node " << dest.endpoint() << " not found";
             return CORE_GENERIC_ERROR;);
 
     http::Response msg;
@@ -319,7 +705,7 @@ Status error(MessengerContext* context, Message *resp, const NodeTag& dest, uint
 NeighbourNode* find_node_by_uri(const NodeTag &uri, const UriSocketMap * nodes, NeighbourNode **dest) {
     auto&& it = nodes->find(uri);
     if(it == nodes->end()) return nullptr;
-    return it->second;
+    return it->second.pick();
 }
 
 QhmEndpoint qhm_endpoint_from_configuration(const Configuration &c) {
@@ -334,7 +720,9 @@ QhmEndpoint qhm_endpoint_from_configuration(const Configuration &c) {
     int port;
     core_try(port = std::stoi(port_str),  core_err << e.what(););
 
-    return QhmEndpoint(self_ip, port, tag);
+    QhmEndpoint self(self_ip, port, Interned::intern(tag));
+    self.intern();
+    return self;
 }
 
 QhmEndpoint parse_url(const std::string &url_string) {
@@ -366,6 +754,17 @@ std::string parse_path(const std::string& url_string){
 }
 
 QhmEndpoint::QhmEndpoint(const IpAddress &ip, const int p, const NodeTag &uri):
-        port(p),ip_address(ip), tag(uri) {
-    endpoint = ip_address + ":" + std::to_string(port);
+        _port(p), _ip_address(ip), _tag(uri) {
+    _endpoint = _ip_address + ":" + std::to_string(_port);
+    _encoded = encode_qhm_endpoint(*this);
+}
+
+QhmEndpoint::QhmEndpoint(const IpAddress &ip, const int p, const NodeTag &uri, const std::string &enc):
+        _port(p), _ip_address(ip), _tag(uri), _encoded(enc) {
+    _endpoint = _ip_address + ":" + std::to_string(_port);
+}
+
+void QhmEndpoint::intern() {
+    _tag = Interned::intern(_tag);
+    _endpoint = Interned::intern(_endpoint);
 }
\ No newline at end of file
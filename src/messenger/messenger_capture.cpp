@@ -0,0 +1,114 @@
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+#include "messenger/messenger.h"
+
+static const int FLIGHT_RECORDER_SIGNAL = SIGUSR2;
+
+// bumped by the signal handler, each worker dumps when it sees a value it has not served yet
+static std::atomic<unsigned> flight_recorder_requests(0);
+
+static void _on_flight_recorder_signal(int) {
+    flight_recorder_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* installed once, and only over the default disposition: an application handler wins */
+unsigned install_flight_recorder_signal() {
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        struct sigaction current;
+        if(sigaction(FLIGHT_RECORDER_SIGNAL, nullptr, &current) != 0 || current.sa_handler != SIG_DFL) return;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &_on_flight_recorder_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(FLIGHT_RECORDER_SIGNAL, &action, nullptr);
+    });
+    // a worker started later only serves the requests that come after it
+    return flight_recorder_requests.load(std::memory_order_relaxed);
+}
+
+void request_flight_recorder_dump() {
+    flight_recorder_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Messenger::observe(const QhmSockets::Message &message) {
+    context->flight_recorder.record(message, context->self_address);
+    if(context->capture)
+        context->capture->write(message.arrival_time() ? message.arrival_time() : time_now(), message.source(),
+                                context->self_address, message.data(), message.size());
+}
+
+void Messenger::dump_flight_recorder() {
+    unsigned requested = flight_recorder_requests.load(std::memory_order_relaxed);
+    if(requested == context->flight_recorder_dumps) return;
+    context->flight_recorder_dumps = requested;
+
+    auto path = context->flight_recorder_dir + "/" + node_self.tag() + "-" + std::to_string(getpid()) + "-"
+                + std::to_string(requested) + ".pcap";
+    core_assert(context->flight_recorder.dump(path), core_err_tag(node_self.tag()) << "cannot write " << path; return;);
+    core_ok_tag(node_self.tag()) << "flight recorder: " << context->flight_recorder.size() << " datagrams in " << path;
+}
+
+ReplayResult replay_capture(const std::string &path, const SockEndpoint &target, const ReplayOptions &options) {
+    ReplayResult result;
+    QhmSockets::CaptureReader reader;
+    core_assert(reader.open(path), core_err << "[replay] cannot read " << path; return result;);
+    QhmSockets::SockAddr dest;
+    core_assert(QhmSockets::resolve_endpoint(target, &dest), core_err << "[replay] cannot resolve " << target;
+            return result;);
+
+    // replies go where application-src says: when they are wanted, each request says here
+    QhmSockets::Socket socket;
+    std::string reply_to;
+    if(!options.reply_ip.empty()) {
+        std::string local_endpoint;
+        int port = _random_endpoint(socket, options.reply_ip, local_endpoint);
+        core_assert(port, core_err << "[replay] cannot find a port to bind to"; return result;);
+        reply_to = serialize_qhm_endpoint({options.reply_ip, port, "replay"});
+    }
+
+    QhmSockets::Message reply;
+    auto collect = [&](int wait) {
+        while(reply.recv(socket, wait)) { result.replies++; wait = 0; }
+    };
+    auto terminate = std::to_string(SERVICE_TERMINATE);
+
+    QhmSockets::CapturedDatagram datagram;
+    c_time_t started = time_now(), first = -1;
+    while(reader.next(&datagram)) {
+        if(first < 0) first = datagram.time;
+        auto& payload = datagram.payload;
+        std::string type;
+        if(http::peek_header(payload.data(), payload.size(), HEADER_KEY_APP_MESSAGETYPE, &type) && type == terminate)
+        { result.skipped++; continue; }
+        if(!reply_to.empty()) {
+            auto request = http::parse_request(payload.data(), payload.size());
+            if(!request.success) { result.skipped++; continue; }
+            request.headers[HEADER_KEY_SERVICE_SRC] = reply_to;
+            payload = http::serialize(&request);
+        }
+
+        if(options.speed > 0) {
+            c_time_t due = started + (c_time_t) ((datagram.time - first) / options.speed);
+            for(c_time_t now = time_now(); now < due; now = time_now()) {
+                if(reply_to.empty()) usleep((useconds_t) (due - now));
+                else collect((int) ((due - now) / 1000));
+            }
+        }
+        QhmSockets::Message(payload).send_to(socket, dest);
+        result.sent++;
+        if(!reply_to.empty()) collect(0);
+    }
+
+    if(!reply_to.empty()) {
+        c_time_t deadline = time_now() + (c_time_t) options.linger * 1000;
+        for(c_time_t now = time_now(); result.replies < result.sent && now < deadline; now = time_now())
+            collect((int) std::max<c_time_t>((deadline - now) / 1000, 1));
+    }
+    result.elapsed = time_now() - started;
+    return result;
+}
@@ -1,23 +1,11 @@
 //
 // Created by Giulio Luzzati on 10/09/18.
 //
+#include <random>
 #include "messenger/messenger.h"
 
 NeighbourNode::NeighbourNode(const QhmEndpoint &node) : QhmEndpoint(node) {
-    socket = new QhmSockets::Socket();
-    socket->setsockopt(SNDTIMEO, 100);
-    core_try(socket->connect(endpoint);, core_err << "error connecting to socket " << endpoint;);
-}
-
-NeighbourNode::NeighbourNode(const QhmEndpoint &node, const std::string &src_ip) : QhmEndpoint(node) {
-    socket = new QhmSockets::Socket();
-    socket->setsockopt(SNDTIMEO, 100);
-    core_try(socket->connect(endpoint, src_ip); , core_err << "error connecting to socket " << endpoint;);
-}
-
-NeighbourNode::~NeighbourNode() {
-    core_try(socket->disconnect(endpoint), core_err << "error disconnecting to socket " << endpoint;);
-    delete socket;
+    core_assert(QhmSockets::resolve_endpoint(endpoint(), &address), core_err << "cannot resolve " << endpoint(););
 }
 
 void _set_dst(http::Message* m, QhmEndpoint* n){
@@ -25,17 +13,65 @@ void _set_dst(http::Message* m, QhmEndpoint* n){
 }
 
 Status NeighbourNode::generate_request(http::Message ** m) {
-    (*m) = new http::Request();
+    (*m) = http::new_request();
     _set_dst(*m, this);
     return CORE_OK;
 }
 
 Status NeighbourNode::generate_response(http::Message ** m) {
-    (*m) = new http::Response();
+    (*m) = http::new_response();
     _set_dst(*m, this);
     return CORE_OK;
 }
 bool NeighbourNode::connected() {
-    // implement ping!
-    return true;
-}
\ No newline at end of file
+    // known broken while its circuit breaker is open
+    return address.valid() && !breaker_open(endpoint());
+}
+
+int NeighbourNode::load() const {
+    return load_state->outstanding + (load_state->hint_expires > time_now() ? (int) load_state->hint : 0);
+}
+
+NeighbourNode* ServiceGroup::find(const SockEndpoint &endpoint) const {
+    for(auto node: members)
+        if(node->endpoint() == endpoint) return node;
+    return nullptr;
+}
+
+/* power of two choices: the less loaded of two random members, unless one is known broken. When the load does not
+ * tell them apart, a coin weighted by their weights does. While no member reported its load lately, the weights alone
+ * split the traffic, each discounted by the requests the member has not answered yet */
+NeighbourNode* ServiceGroup::pick() const {
+    if(members.empty()) return nullptr;
+    if(members.size() == 1) return members.front();
+
+    static thread_local std::minstd_rand rng(std::random_device{}());
+    auto now = time_now();
+    bool hinted = false;
+    for(auto node: members)
+        if(node->load_state->hint_expires > now) { hinted = true; break; }
+    if(!hinted) {
+        double total = 0;
+        for(auto node: members)
+            if(node->connected()) total += (double) node->weight / (1 + node->load_state->outstanding);
+        if(total > 0) {
+            double choice = std::uniform_real_distribution<double>(0, total)(rng);
+            for(auto node: members) {
+                if(!node->connected()) continue;
+                choice -= (double) node->weight / (1 + node->load_state->outstanding);
+                if(choice < 0) return node;
+            }
+        }
+    }
+
+    size_t a = rng() % members.size();
+    size_t b = rng() % (members.size() - 1);
+    if(b >= a) b++;
+
+    NeighbourNode *first = members[a], *second = members[b];
+    if(!first->connected()) return second;
+    if(!second->connected()) return first;
+    int first_load = first->load(), second_load = second->load();
+    if(first_load != second_load) return first_load < second_load ? first : second;
+    return (int) (rng() % (first->weight + second->weight)) < first->weight ? first : second;
+}
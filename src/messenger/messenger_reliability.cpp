@@ -0,0 +1,186 @@
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include "messenger/messenger.h"
+
+/* per-peer round trip estimate (Jacobson/Karels, RFC 6298), shared by every thread sending requests */
+struct RttEstimator {
+    c_time_t    srtt = 0;       // usec
+    c_time_t    rttvar = 0;     // usec
+    bool        initialized = false;
+};
+
+static std::mutex                                   rtt_lock;
+static std::unordered_map<SockEndpoint, RttEstimator> rtt_estimators;
+
+int peer_rto(const SockEndpoint& peer) {
+    std::lock_guard<std::mutex> guard(rtt_lock);
+    auto it = rtt_estimators.find(peer);
+    if(it == rtt_estimators.end() || !it->second.initialized) return RELIABLE_INITIAL_RTO_MS;
+    c_time_t rto = it->second.srtt + std::max<c_time_t>(1000, 4 * it->second.rttvar);
+    rto /= 1000;
+    if(rto < RELIABLE_MIN_RTO_MS) return RELIABLE_MIN_RTO_MS;
+    if(rto > RELIABLE_MAX_RTO_MS) return RELIABLE_MAX_RTO_MS;
+    return (int) rto;
+}
+
+void peer_rtt_sample(const SockEndpoint& peer, c_time_t rtt) {
+    std::lock_guard<std::mutex> guard(rtt_lock);
+    auto& e = rtt_estimators[peer];
+    if(!e.initialized) {
+        e.srtt = rtt;
+        e.rttvar = rtt / 2;
+        e.initialized = true;
+        return;
+    }
+    c_time_t delta = e.srtt > rtt ? e.srtt - rtt : rtt - e.srtt;
+    e.rttvar = (3 * e.rttvar + delta) / 4;
+    e.srtt = (7 * e.srtt + rtt) / 8;
+}
+
+/* per-destination circuit breaker: BREAKER_FAILURE_THRESHOLD failures in a row (timeouts, 5xx) open it, requests
+ * then fail fast for BREAKER_OPEN_MS. After that it is half open: BREAKER_HALF_OPEN_PROBES requests at a time go
+ * through, a success closes it and a failure opens it again */
+enum BreakerState { BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN };
+
+struct CircuitBreaker {
+    BreakerState    state = BREAKER_CLOSED;
+    int             failures = 0;
+    int             probes = 0;         // in flight while half open
+    c_time_t        open_until = 0;
+};
+
+static std::mutex                                       breaker_lock;
+static std::unordered_map<SockEndpoint, CircuitBreaker> breakers;
+
+bool breaker_allow(const SockEndpoint& peer) {
+    std::lock_guard<std::mutex> guard(breaker_lock);
+    auto it = breakers.find(peer);
+    if(it == breakers.end()) return true;
+    auto& b = it->second;
+    switch(b.state) {
+        case BREAKER_CLOSED: return true;
+        case BREAKER_OPEN:
+            if(time_now() < b.open_until) return false;
+            b.state = BREAKER_HALF_OPEN;
+            b.probes = 0;
+            // fall through
+        case BREAKER_HALF_OPEN:
+            if(b.probes >= BREAKER_HALF_OPEN_PROBES) return false;
+            b.probes++;
+            return true;
+    }
+    return true;
+}
+
+void breaker_record(const SockEndpoint& peer, bool success) {
+    std::lock_guard<std::mutex> guard(breaker_lock);
+    if(success) {
+        auto it = breakers.find(peer);
+        if(it != breakers.end()) breakers.erase(it);
+        return;
+    }
+    auto& b = breakers[peer];
+    if(b.state == BREAKER_HALF_OPEN || ++b.failures >= BREAKER_FAILURE_THRESHOLD) {
+        b.state = BREAKER_OPEN;
+        b.open_until = time_now() + BREAKER_OPEN_MS * 1000;
+    }
+}
+
+/* a probe that ended without saying anything about the peer: the request was never sent, or another replica
+ * answered it. The slot goes back, the next request probes instead */
+void breaker_release(const SockEndpoint& peer) {
+    std::lock_guard<std::mutex> guard(breaker_lock);
+    auto it = breakers.find(peer);
+    if(it != breakers.end() && it->second.state == BREAKER_HALF_OPEN && it->second.probes > 0) it->second.probes--;
+}
+
+bool breaker_open(const SockEndpoint& peer) {
+    std::lock_guard<std::mutex> guard(breaker_lock);
+    auto it = breakers.find(peer);
+    return it != breakers.end() && it->second.state == BREAKER_OPEN && time_now() < it->second.open_until;
+}
+
+/* the latest response times per route (destination tag and path), hedging waits for one of their percentiles */
+struct RouteLatency {
+    std::vector<c_time_t>   samples;    // usec, a ring of HEDGE_LATENCY_SAMPLES
+    size_t                  next = 0;
+};
+
+static std::mutex                                   latency_lock;
+static std::unordered_map<std::string, RouteLatency> route_latencies;
+
+int route_latency_percentile(const std::string& route, double percentile) {
+    std::vector<c_time_t> samples;
+    {
+        std::lock_guard<std::mutex> guard(latency_lock);
+        auto it = route_latencies.find(route);
+        if(it == route_latencies.end() || it->second.samples.size() < HEDGE_MIN_SAMPLES) return -1;
+        samples = it->second.samples;
+    }
+    auto nth = samples.begin() + (size_t) (percentile * (samples.size() - 1));
+    std::nth_element(samples.begin(), nth, samples.end());
+    return (int) ((*nth + 999) / 1000);
+}
+
+void route_latency_sample(const std::string& route, c_time_t latency) {
+    std::lock_guard<std::mutex> guard(latency_lock);
+    auto& l = route_latencies[route];
+    if(l.samples.size() < HEDGE_LATENCY_SAMPLES) l.samples.push_back(latency);
+    else l.samples[l.next] = latency;
+    l.next = (l.next + 1) % HEDGE_LATENCY_SAMPLES;
+}
+
+/* hedges are paid with tokens, every hedgeable request earns HEDGE_BUDGET_RATIO of one: at most that fraction of
+ * the requests is duplicated, with bursts of HEDGE_BUDGET_BURST */
+static std::mutex   hedge_lock;
+static double       hedge_tokens = HEDGE_BUDGET_BURST;
+
+void hedge_budget_deposit() {
+    std::lock_guard<std::mutex> guard(hedge_lock);
+    hedge_tokens = std::min(HEDGE_BUDGET_BURST, hedge_tokens + HEDGE_BUDGET_RATIO);
+}
+
+bool hedge_budget_take() {
+    std::lock_guard<std::mutex> guard(hedge_lock);
+    if(hedge_tokens < 1) return false;
+    hedge_tokens -= 1;
+    return true;
+}
+
+std::string next_procedure_id() {
+    static std::random_device rd;
+    static std::atomic<uint64_t> counter{rd() | ((uint64_t) rd() << 32)};
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) counter++);
+    return std::string(buf);
+}
+
+const CachedReply* IdempotencyCache::find(const std::string &src, const std::string &procid) {
+    auto it = entries.find(src + "|" + procid);
+    if(it == entries.end()) return nullptr;
+    if(it->second.expires <= time_now()) {
+        entries.erase(it);
+        return nullptr;
+    }
+    hits++;
+    return &it->second.reply;
+}
+
+void IdempotencyCache::store(const std::string &src, const std::string &procid, const CachedReply &reply) {
+    if(!enabled()) return;
+    auto now = time_now();
+    auto key = src + "|" + procid;
+    auto expires = now + ttl;
+
+    entries[key] = {reply, expires};
+    order.emplace_back(key, expires);
+
+    // entries re-stored after expiring leave a stale record behind, which must not evict the fresh one
+    while(!order.empty() && (order.front().second <= now || entries.size() > capacity)) {
+        auto it = entries.find(order.front().first);
+        if(it != entries.end() && it->second.expires == order.front().second) entries.erase(it);
+        order.pop_front();
+    }
+}
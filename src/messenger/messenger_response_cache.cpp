@@ -0,0 +1,74 @@
+#include "messenger/messenger.h"
+
+/* the path without query, repeated and trailing slashes, then the selected query params and headers in the order the
+ * policy lists them: requests differing elsewhere share the entry */
+std::string response_cache_key(const http::Request *request, const RouteCachePolicy &policy) {
+    const std::string& url = request->path;
+    size_t query = url.find('?');
+    std::string key;
+    key.reserve(url.size() + 16);
+
+    for(size_t i = 0; i < std::min(query, url.size()); i++)
+        if(url[i] != '/' || key.empty() || key.back() != '/') key.push_back(url[i]);
+    if(key.size() > 1 && key.back() == '/') key.pop_back();
+
+    for(auto&& name: policy.query_params) {
+        key += "\n?" + name + "=";
+        if(query == std::string::npos) continue;
+        size_t start = query + 1;
+        while(start < url.size()) {
+            size_t end = std::min(url.find('&', start), url.size());
+            if(url.compare(start, name.size(), name) == 0 && start + name.size() < end
+               && url[start + name.size()] == '=') {
+                key.append(url, start + name.size() + 1, end - start - name.size() - 1);
+                break;
+            }
+            start = end + 1;
+        }
+    }
+
+    for(auto&& name: policy.headers) {
+        key += "\n" + name + ":";
+        auto it = request->headers.find(name);
+        if(it != request->headers.end()) key += it->second;
+    }
+
+    return key;
+}
+
+const std::string* ResponseCache::find(const std::string &key) {
+    auto it = entries.find(key);
+    if(it == entries.end()) { misses++; return nullptr; }
+    if(it->second.expires <= time_now()) {
+        size -= key.size() + it->second.reply.size();
+        lru.erase(it->second.lru);
+        entries.erase(it);
+        misses++;
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second.lru);
+    hits++;
+    return &it->second.reply;
+}
+
+void ResponseCache::store(const std::string &key, const std::string &reply, c_time_t ttl) {
+    if(key.size() + reply.size() > capacity) return;
+
+    auto it = entries.find(key);
+    if(it != entries.end()) {
+        size -= key.size() + it->second.reply.size();
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    lru.push_front(key);
+    entries[key] = {reply, time_now() + ttl, lru.begin()};
+    size += key.size() + reply.size();
+
+    while(size > capacity) {
+        auto victim = entries.find(lru.back());
+        size -= victim->first.size() + victim->second.reply.size();
+        entries.erase(victim);
+        lru.pop_back();
+    }
+}
@@ -80,7 +80,8 @@ Route* Router::match(const std::string &url) {
     return nullptr;
 }
 
-void Router::add_route(const std::string &route, RouteHandler handler) {
+void Router::add_route(const std::string &route, RouteHandler handler, const RouteCachePolicy& cache) {
     auto params_schema = parse_param_ids_in_route(route);
-    routes.emplace_back(Route{ std::regex(generate_route_regex(route)), handler, url_depth(route), params_schema });
+    routes.emplace_back(Route{ std::regex(generate_route_regex(route)), handler, url_depth(route), params_schema,
+                               cache, route });
 }
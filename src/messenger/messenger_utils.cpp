@@ -3,6 +3,11 @@
 //
 
 #include <random>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <arpa/inet.h>
+#include "base64/base64.h"
 #include "uuid/uuid.h"
 #include "messenger/messenger.h"
 
@@ -21,38 +26,136 @@ QhmSockets::Message message_from_type(
     return ret;
 }
 
-QhmEndpoint parse_qhm_endpoint(const std::string &in){
-    QhmEndpoint ret;
-    bool valid_endpoint = true;
+/* compact endpoint encoding:
+ *   [version][family][address][port (2 bytes, network order)][tag]
+ * family is 4 (4 bytes ipv4), 6 (16 bytes ipv6) or 0 (1 byte length + textual host). The whole thing is base64'd so
+ * that it can travel as an http header value. */
+#define QHM_ENDPOINT_CODEC_VERSION  1
+#define QHM_ENDPOINT_FAMILY_TEXT    0
+#define QHM_ENDPOINT_FAMILY_IPV4    4
+#define QHM_ENDPOINT_FAMILY_IPV6    6
+
+std::string encode_qhm_endpoint(const QhmEndpoint &node){
+    std::string raw;
+    raw.reserve(24 + node.tag().size());
+    raw.push_back((char) QHM_ENDPOINT_CODEC_VERSION);
+
+    unsigned char addr[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, node.ip_address().c_str(), addr) == 1) {
+        raw.push_back((char) QHM_ENDPOINT_FAMILY_IPV4);
+        raw.append((const char *) addr, sizeof(struct in_addr));
+    } else if (inet_pton(AF_INET6, node.ip_address().c_str(), addr) == 1) {
+        raw.push_back((char) QHM_ENDPOINT_FAMILY_IPV6);
+        raw.append((const char *) addr, sizeof(struct in6_addr));
+    } else {
+        core_assert(node.ip_address().size() <= 255, return "");
+        raw.push_back((char) QHM_ENDPOINT_FAMILY_TEXT);
+        raw.push_back((char) node.ip_address().size());
+        raw.append(node.ip_address());
+    }
+
+    auto port = (uint16_t) node.port();
+    raw.push_back((char) (port >> 8));
+    raw.push_back((char) (port & 0xFF));
+    raw.append(node.tag());
+
+    return macaron::Base64::Encode(raw);
+}
+
+static bool _is_base64(const std::string& in){
+    if(in.empty() || in.size() % 4 != 0) return false;
+    for (auto &&c : in)
+        if (!isalnum((unsigned char) c) && c != '+' && c != '/' && c != '=') return false;
+    return true;
+}
+
+static bool _decode_qhm_endpoint(const std::string &in, QhmEndpoint* out){
+    std::string raw;
+    if(!_is_base64(in) || !macaron::Base64::Decode(in, raw).empty()) return false;
+    if(raw.size() < 2 || raw[0] != (char) QHM_ENDPOINT_CODEC_VERSION) return false;
+
+    size_t pos = 2;
+    char text_addr[INET6_ADDRSTRLEN];
+    IpAddress ip;
+    switch (raw[1]) {
+        case QHM_ENDPOINT_FAMILY_IPV4:
+            if(raw.size() < pos + sizeof(struct in_addr)) return false;
+            inet_ntop(AF_INET, raw.data() + pos, text_addr, sizeof(text_addr));
+            ip = text_addr;
+            pos += sizeof(struct in_addr);
+            break;
+        case QHM_ENDPOINT_FAMILY_IPV6:
+            if(raw.size() < pos + sizeof(struct in6_addr)) return false;
+            inet_ntop(AF_INET6, raw.data() + pos, text_addr, sizeof(text_addr));
+            ip = text_addr;
+            pos += sizeof(struct in6_addr);
+            break;
+        case QHM_ENDPOINT_FAMILY_TEXT: {
+            if(raw.size() < pos + 1) return false;
+            size_t len = (unsigned char) raw[pos++];
+            if(raw.size() < pos + len) return false;
+            ip = raw.substr(pos, len);
+            pos += len;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    if(raw.size() < pos + 2) return false;
+    int port = ((unsigned char) raw[pos] << 8) | (unsigned char) raw[pos + 1];
+    pos += 2;
+
+    *out = QhmEndpoint(ip, port, raw.substr(pos), in);
+    return true;
+}
+
+// legacy {"endpoint": "ip:port", "tag": "..."} form, only kept for compatibility with older peers
+static bool _parse_json_qhm_endpoint(const std::string &in, QhmEndpoint* out){
     nlohmann::json obj;
+    bool valid_endpoint = true;
     core_try(obj = nlohmann::json::parse(in), valid_endpoint = false;);
-    core_assert(valid_endpoint, core_warn << in << " invalid"; return ret);
-    ret.tag = obj[MESSENGER_NODE_TAG];
-    ret.endpoint = obj[MESSENGER_NODE_ENDPOINT];
-    valid_endpoint = valid_endpoint && !ret.tag.empty() && ! ret.endpoint.empty();
+    if(!valid_endpoint || !obj.is_object()) return false;
+    std::string tag, endpoint;
+    core_try(tag = obj.value(MESSENGER_NODE_TAG, "");
+             endpoint = obj.value(MESSENGER_NODE_ENDPOINT, ""), return false;);
+    auto tokens = split(endpoint, ':');
+    if(tokens.size() != 2) return false;
+    int port;
+    core_try(port = std::stoi(tokens[1]), return false;);
+    *out = QhmEndpoint(tokens[0], port, tag);
+    return true;
+}
+
+QhmEndpoint parse_qhm_endpoint(const std::string &in){
+    QhmEndpoint ret;
+    bool valid_endpoint = !in.empty() && in[0] == '{' ?
+                          _parse_json_qhm_endpoint(in, &ret) : _decode_qhm_endpoint(in, &ret);
+    core_assert(valid_endpoint, core_warn << in << " invalid"; return QhmEndpoint());
+    valid_endpoint = !ret.tag().empty() && !ret.endpoint().empty();
     core_assert(valid_endpoint, );
     return ret;
 }
 
 std::string serialize_qhm_endpoint(const QhmEndpoint &node){
-    nlohmann::json obj;
-    obj[MESSENGER_NODE_ENDPOINT] = node.endpoint;
-    obj[MESSENGER_NODE_TAG] = node.tag;
-    return obj.dump();
+    return node.encoded().empty() ? encode_qhm_endpoint(node) : node.encoded();
 }
 
 Status parse_http(const void *src, size_t len, http::Message ** http_in) {
-    *http_in = new http::Request(http::parse_request(src, len));
-    if (validate_http_message(*http_in, msg_schema)) return CORE_OK;
-    http::http_free(*http_in);
-    *http_in = new http::Response(http::parse_response(src, len));
-    if (validate_http_message(*http_in, msg_schema)) return CORE_OK;
-    http::http_free(*http_in);
+    auto request = http::new_request();
+    *http_in = request;
+    if (http::parse_request(src, len, request) && validate_http_message(request, msg_schema)) return CORE_OK;
+    http::http_free(request);
+    auto response = http::new_response();
+    *http_in = response;
+    if (http::parse_response(src, len, response) && validate_http_message(response, msg_schema)) return CORE_OK;
+    http::http_free(response);
+    *http_in = nullptr;
     return CORE_GENERIC_ERROR;
 }
 
 void generate_response(const http::Message *request, http::Message **out, http_status status){
-    *out = new http::Response();
+    *out = http::new_response();
     auto response = __as_response(*out);
     response->headers[HEADER_KEY_SERVICE_DST] = request->headers.at(HEADER_KEY_SERVICE_SRC);
     response->status = status;
@@ -74,67 +177,277 @@ int _random_endpoint(QhmSockets::Socket& recv_socket, const std::string& ip, std
     return 0;
 };
 
-http::Response sync_send_request(http::Request *request, const QhmEndpoint &host, const QhmEndpoint &dest_node,
-                                 int timeout){
-    NeighbourNode n(dest_node, host.ip_address);
-    n.socket->setsockopt(SNDTIMEO, timeout);
+/* the request again, with what is left of its budget: the receiver must not believe it has the whole of it */
+static QhmSockets::Message _with_budget(http::Request* request, c_time_t deadline, c_time_t now) {
+    request->headers[HEADER_KEY_DEADLINE] = std::to_string((deadline - now) / 1000);
+    return QhmSockets::Message(http::serialize(request));
+}
 
-    QhmSockets::Socket   recv_socket;
-    recv_socket.setsockopt(RCVTIMEO, timeout);
+/* sends until something comes back or the deadline passes, waiting one (backed off) RTO between attempts */
+static void _reliable_exchange(const QhmSockets::Message& out, http::Request* request, QhmSockets::Message* in,
+                               QhmSockets::Socket& socket, const QhmSockets::SockAddr& dest, const SockEndpoint& peer,
+                               int timeout) {
+    c_time_t deadline = time_now() + (c_time_t) timeout * 1000;
+    int rto = peer_rto(peer);
+    int attempt = 0;
+    while(true) {
+        c_time_t sent = time_now();
+        // under a millisecond left, the receiver would drop it
+        if(deadline - sent < 1000) return;
+        if(attempt) _with_budget(request, deadline, sent).send_to(socket, dest);
+        else out.send_to(socket, dest);
+        attempt++;
+        int wait = (int) std::min<c_time_t>(rto, (deadline - sent + 999) / 1000);
+        if(in->recv(socket, wait)) {
+            // Karn: a reply to a retransmitted request is an ambiguous sample
+            if(attempt == 1) peer_rtt_sample(peer, time_now() - sent);
+            return;
+        }
+        rto = std::min(rto * 2, RELIABLE_MAX_RTO_MS);
+    }
+}
+
+/* the request goes to the primary; if no reply came within delay ms, and the budget allows, the same request goes to
+ * the hedge replica too. The first reply wins, the other one reaches a closed socket */
+static void _hedged_exchange(const QhmSockets::Message& out, const http::Request& request, QhmSockets::Message* in,
+                             QhmSockets::Socket& socket, const QhmSockets::SockAddr& dest,
+                             const QhmEndpoint& hedge, int delay, int timeout) {
+    c_time_t deadline = time_now() + (c_time_t) timeout * 1000;
+    out.send_to(socket, dest);
+
+    if(delay >= 0 && delay < timeout) {
+        if(in->recv(socket, delay)) return;
+
+        QhmSockets::SockAddr hedge_address;
+        if(hedge_budget_take() && QhmSockets::resolve_endpoint(hedge.endpoint(), &hedge_address)) {
+            http::Request hedged(request);
+            hedged.headers[HEADER_KEY_SERVICE_DST] = serialize_qhm_endpoint(hedge);
+            _with_budget(&hedged, deadline, time_now()).send_to(socket, hedge_address);
+        }
+    }
+
+    c_time_t remaining = deadline - time_now();
+    if(remaining > 0) in->recv(socket, (int) ((remaining + 999) / 1000));
+}
+
+static bool _replied_by(const http::Response& response, const QhmEndpoint& node) {
+    auto src = response.headers.find(HEADER_KEY_SERVICE_SRC);
+    if(src == response.headers.end()) return false;
+    auto replier = parse_qhm_endpoint(src->second);
+    return replier.port() == node.port() && replier.ip_address() == node.ip_address();
+}
+
+/* the deadline of the request this thread is handling, if any */
+static thread_local c_time_t current_deadline = 0;
 
+c_time_t request_deadline() {
+    return current_deadline;
+}
+
+void set_request_deadline(c_time_t deadline) {
+    current_deadline = deadline;
+}
+
+/* GETs in flight with coalescing, keyed on everything that makes two of them different: destination, path and query,
+ * body and headers, except those that sync_send_request sets itself */
+struct Flight {
+    bool            done = false;
+    http::Response  response;
+};
+
+static std::mutex                                               flights_lock;
+static std::condition_variable                                  flights_done;
+static std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+
+static std::string _flight_key(const http::Request* request, const QhmEndpoint& dest_node) {
+    std::string key = dest_node.endpoint() + "\n" + request->path + "\n";
+    for(auto&& header: request->headers)
+        if(header.first != HEADER_KEY_SERVICE_SRC && header.first != HEADER_KEY_SERVICE_DST
+           && header.first != HEADER_KEY_PROCEDURE_ID && header.first != HEADER_KEY_DEADLINE
+           && header.first != HEADER_KEY_TRACE)
+            key += header.first + ": " + header.second + "\n";
+    return key + "\n" + request->body;
+}
+
+http::Response sync_send_request(http::Request *request, const QhmEndpoint &host, const QhmEndpoint &dest_node,
+                                 int timeout, const RequestOptions& options){
+    trace::Span send_span("send_request");
     http::Response response;
     response.status = HTTP_STATUS_SERVICE_UNAVAILABLE;
 
+    if(options.coalesce && request->method == HTTP_GET) {
+        auto key = _flight_key(request, dest_node);
+        std::unique_lock<std::mutex> lock(flights_lock);
+        auto it = flights.find(key);
+        if(it != flights.end()) {
+            // someone is already asking: wait for its answer
+            auto flight = it->second;
+            if(!flights_done.wait_for(lock, std::chrono::milliseconds(timeout), [&flight]{ return flight->done; }))
+            {core_err << "[send request] timed out"; response.status = HTTP_STATUS_REQUEST_TIMEOUT; return response;}
+            return flight->response;
+        }
+        auto flight = std::make_shared<Flight>();
+        flights[key] = flight;
+        lock.unlock();
+
+        RequestOptions leader(options);
+        leader.coalesce = false;
+        response = sync_send_request(request, host, dest_node, timeout, leader);
+
+        lock.lock();
+        flight->response = response;
+        flight->done = true;
+        flights.erase(key);
+        flights_done.notify_all();
+        return response;
+    }
+
+    // a request made on behalf of another one cannot outlive it, the budget left travels with it
+    if(request_deadline()) {
+        c_time_t remaining = (request_deadline() - time_now()) / 1000;
+        if(remaining <= 0)
+        {core_warn << "[send request] deadline expired, not sending"; response.status = HTTP_STATUS_REQUEST_TIMEOUT;
+            return response;}
+        timeout = (int) std::min<c_time_t>(timeout, remaining);
+    }
+    request->headers[HEADER_KEY_DEADLINE] = std::to_string(timeout);
+    // the receiving worker opens its transaction as a child of this span
+    if(trace::enabled()) request->headers[HEADER_KEY_TRACE] = trace::header();
+
+    // a failing peer costs nothing: no resolution, no socket. Past this point a probe is taken and every way out
+    // records or releases it
+    core_assert(breaker_allow(dest_node.endpoint()),
+                core_warn << "[send request] " << dest_node.endpoint() << " is failing, not sending"; return response;);
+
+    QhmSockets::SockAddr dest_address;
+    core_assert(QhmSockets::resolve_endpoint(dest_node.endpoint(), &dest_address),
+                core_err << "[send request] cannot resolve " << dest_node.endpoint();
+                breaker_release(dest_node.endpoint()); return response;);
+
+    QhmSockets::Socket   recv_socket;
+    recv_socket.setsockopt(RCVTIMEO, timeout);
+
     std::string local_endpoint;
-    int port = _random_endpoint(recv_socket, host.ip_address, local_endpoint);
-    core_assert(port, core_err << "[send request] cannot find a port to bind to"; return response;);
+    int port = _random_endpoint(recv_socket, host.ip_address(), local_endpoint);
+    core_assert(port, core_err << "[send request] cannot find a port to bind to";
+                breaker_release(dest_node.endpoint()); return response;);
 
-    QhmEndpoint src_node = { host.ip_address, port, "temp_" + host.tag };
+    QhmEndpoint src_node = { host.ip_address(), port, "temp_" + host.tag() };
 
     request->headers[HEADER_KEY_SERVICE_SRC] = serialize_qhm_endpoint(src_node);
     request->headers[HEADER_KEY_SERVICE_DST] = serialize_qhm_endpoint(dest_node);
+    // retransmits share the procedure id, which is what the server deduplicates on
+    if(options.reliable && !headers_have(request->headers, HEADER_KEY_PROCEDURE_ID))
+        request->headers[HEADER_KEY_PROCEDURE_ID] = next_procedure_id();
 
-    core_assert(validate_http_message(request, msg_schema), return response;);
+    core_assert(validate_http_message(request, msg_schema), breaker_release(dest_node.endpoint()); return response;);
 
-    QhmSockets::Message udpmsg = http::serialize(request);
+    QhmSockets::Message udpmsg;
+    {
+        trace::Span span("serialize");
+        udpmsg = http::serialize(request);
+    }
     QhmSockets::Message in;
 
-    udpmsg.send(*n.socket);
-    in.recv(recv_socket);
+    // sent from the receiving socket, the reply comes back to where the request came from
+    c_time_t sent = time_now();
+    std::string route = dest_node.tag() + request->path.substr(0, request->path.find('?'));
+    {
+        trace::Span span("exchange");
+        if(options.hedge) {
+            hedge_budget_deposit();
+            int delay = options.hedge_delay > 0 ? options.hedge_delay
+                                                : route_latency_percentile(route, options.hedge_percentile);
+            _hedged_exchange(udpmsg, *request, &in, recv_socket, dest_address, *options.hedge, delay, timeout);
+        } else if(options.reliable)
+            _reliable_exchange(udpmsg, request, &in, recv_socket, dest_address, dest_node.endpoint(), timeout);
+        else {
+            udpmsg.send_to(recv_socket, dest_address);
+            in.recv(recv_socket);
+        }
+    }
 
+    // the primary had the whole timeout, hedged or not. It is the tail hedging reacts to: a sample too
     if(in.empty())
     {core_err << "[send request] timed out"; response.status = HTTP_STATUS_REQUEST_TIMEOUT;
+        route_latency_sample(route, (c_time_t) timeout * 1000);
+        breaker_record(dest_node.endpoint(), false);
         return response;}
 
+    route_latency_sample(route, time_now() - sent);
+    trace::Span parse_span("parse_response");
     response = http::parse_response(in.data(), in.size());
+    // a reply from the hedge replica says nothing about the primary
+    if(options.hedge && !_replied_by(response, dest_node)) breaker_release(dest_node.endpoint());
+    else breaker_record(dest_node.endpoint(), response.status < HTTP_STATUS_INTERNAL_SERVER_ERROR);
 
     return response;
 }
 
+/* what a reply says about the load of the replica that sent it */
+static void _record_load(NodeLoad* load, const http::Response& response) {
+    auto hint = response.headers.find(HEADER_KEY_LOAD);
+    if(hint == response.headers.end()) return;
+    core_try(load->hint = std::stoi(hint->second), return;);
+    load->hint_expires = time_now() + LOAD_HINT_TTL_MS * 1000;
+}
+
+http::Response sync_send_request(MessengerContext* context, http::Request *request, const NodeTag& tag,
+                                 int timeout, const RequestOptions& options){
+    http::Response response;
+    response.status = HTTP_STATUS_SERVICE_UNAVAILABLE;
+
+    NeighbourNode* node = find_node_by_uri(tag, &context->known_nodes, &node);
+    core_assert(node, core_warn_tag(context->node_self->tag()) << "no node known as " << tag; return response;);
+
+    auto load = node->load_state;
+    load->outstanding++;
+    response = sync_send_request(request, *context->node_self, *node, timeout, options);
+    load->outstanding--;
+    _record_load(load.get(), response);
+    return response;
+}
+
+/* as the sync one, on a thread of its own: the replica picked is counted busy until it replies or the timeout
+ * passes, which the caller does not wait for */
+void async_send_request(MessengerContext* context, http::Request *request, const NodeTag& tag, int timeout){
+    NeighbourNode* node = find_node_by_uri(tag, &context->known_nodes, &node);
+    core_assert(node, core_warn_tag(context->node_self->tag()) << "no node known as " << tag; return;);
+
+    auto load = node->load_state;
+    load->outstanding++;
+    c_time_t deadline = request_deadline();
+    QhmEndpoint host = *context->node_self, dest = *node;
+    std::thread([load, deadline, host, dest, timeout](http::Request request) {
+        set_request_deadline(deadline);
+        auto response = sync_send_request(&request, host, dest, timeout);
+        load->outstanding--;
+        _record_load(load.get(), response);
+    }, *request).detach();
+}
+
 void async_send_request(http::Request *request, const QhmEndpoint &host, const QhmEndpoint &dest_node,
                                  int timeout){
-    NeighbourNode n(dest_node, host.ip_address);
-    n.socket->setsockopt(SNDTIMEO, timeout);
+    QhmSockets::SockAddr dest_address;
+    core_assert(QhmSockets::resolve_endpoint(dest_node.endpoint(), &dest_address),
+                core_err << "[send request] cannot resolve " << dest_node.endpoint(); return;);
 
     QhmSockets::Socket   recv_socket;
     recv_socket.setsockopt(RCVTIMEO, timeout);
 
-    http::Response response;
-    response.status = HTTP_STATUS_SERVICE_UNAVAILABLE;
-
     std::string local_endpoint;
-    int port = _random_endpoint(recv_socket, host.ip_address, local_endpoint);
+    int port = _random_endpoint(recv_socket, host.ip_address(), local_endpoint);
     core_assert(port, core_err << "[send request] cannot find a port to bind to"; return;);
 
-    QhmEndpoint src_node = { host.ip_address, port, "temp_" + host.tag };
+    QhmEndpoint src_node = { host.ip_address(), port, "temp_" + host.tag() };
 
     request->headers[HEADER_KEY_SERVICE_SRC] = serialize_qhm_endpoint(src_node);
     request->headers[HEADER_KEY_SERVICE_DST] = serialize_qhm_endpoint(dest_node);
+    if(trace::enabled()) request->headers[HEADER_KEY_TRACE] = trace::header();
 
-    assert(validate_http_message(request, msg_schema));
     core_assert(validate_http_message(request, msg_schema), return;);
 
     QhmSockets::Message udpmsg = http::serialize(request);
 
-    udpmsg.send(*n.socket);
+    udpmsg.send_to(recv_socket, dest_address);
 }
\ No newline at end of file
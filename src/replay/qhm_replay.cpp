@@ -0,0 +1,30 @@
+#include <cstdlib>
+#include "messenger/messenger.h"
+
+static int usage(const char* self) {
+    core_err << "usage: " << self << " <capture.pcap> <ip:port> [--speed <factor>] [--reply-ip <ip>] [--linger <ms>]\n"
+             << "  --speed 2 replays twice as fast as captured, 0 as fast as possible\n"
+             << "  --reply-ip has replies come back to a port on this address, and counts them";
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 3) return usage(argv[0]);
+
+    ReplayOptions options;
+    for(int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) return usage(argv[0]);
+        if(arg == "--speed") options.speed = atof(argv[++i]);
+        else if(arg == "--reply-ip") options.reply_ip = argv[++i];
+        else if(arg == "--linger") options.linger = atoi(argv[++i]);
+        else return usage(argv[0]);
+    }
+
+    auto result = replay_capture(argv[1], argv[2], options);
+    double seconds = result.elapsed / 1e6;
+    core_ok << "[replay] sent " << result.sent << " datagrams in " << seconds << " s ("
+            << (seconds > 0 ? result.sent / seconds : 0) << "/s), skipped " << result.skipped
+            << (options.reply_ip.empty() ? "" : ", replies " + std::to_string(result.replies));
+    return result.sent ? 0 : 1;
+}
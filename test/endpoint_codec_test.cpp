@@ -0,0 +1,93 @@
+#include <cassert>
+#include "messenger/messenger.h"
+
+bool compact_roundtrip_test() {
+    QhmEndpoint v4 = {"127.0.0.10", QHM_DEFAULT_SERVICE_PORT, "time_service"};
+    QhmEndpoint v6 = {"::1", 5050, "ipv6_node"};
+    QhmEndpoint text = {"", QHM_DEFAULT_REQUEST_PORT, "no_address"};
+
+    for (auto &&node : {v4, v6, text}) {
+        auto wire = serialize_qhm_endpoint(node);
+        assert(wire == node.encoded());
+        assert(wire.find('{') == std::string::npos);
+
+        auto parsed = parse_qhm_endpoint(wire);
+        assert(parsed.tag() == node.tag());
+        assert(parsed.ip_address() == node.ip_address());
+        assert(parsed.port() == node.port());
+        assert(parsed.endpoint() == node.endpoint());
+        assert(parsed.encoded() == wire);
+    }
+
+    // the compact form is way shorter than the json one
+    nlohmann::json legacy;
+    legacy[MESSENGER_NODE_ENDPOINT] = v4.endpoint();
+    legacy[MESSENGER_NODE_TAG] = v4.tag();
+    assert(v4.encoded().size() < legacy.dump().size());
+
+    return true;
+}
+
+bool legacy_json_test() {
+    auto parsed = parse_qhm_endpoint(R"({"endpoint":"127.0.0.11:40401","tag":"relay_service"})");
+    assert(parsed.tag() == "relay_service");
+    assert(parsed.endpoint() == "127.0.0.11:40401");
+    assert(parsed.ip_address() == "127.0.0.11");
+    assert(parsed.port() == 40401);
+    assert(parsed.encoded() == QhmEndpoint("127.0.0.11", 40401, "relay_service").encoded());
+
+    // re-serializing a legacy endpoint yields the compact form
+    auto reparsed = parse_qhm_endpoint(serialize_qhm_endpoint(parsed));
+    assert(reparsed.tag() == parsed.tag());
+    assert(reparsed.endpoint() == parsed.endpoint());
+
+    return true;
+}
+
+bool invalid_input_test() {
+    assert(parse_qhm_endpoint("").tag().empty());
+    assert(parse_qhm_endpoint("not an endpoint").tag().empty());
+    assert(parse_qhm_endpoint("AAAA").tag().empty());
+    assert(parse_qhm_endpoint("{broken json").tag().empty());
+    return true;
+}
+
+bool interned_test() {
+    // values read off the network are not added to the table, whatever a peer sends
+    auto size = Interned::table_size();
+    for (int port = 5050; port < 5150; port++) {
+        auto decoded = parse_qhm_endpoint(serialize_qhm_endpoint({"127.0.0.10", port, "temp_client"}));
+        assert(!decoded.tag().interned() && !decoded.endpoint().interned());
+    }
+    assert(Interned::table_size() == size);
+
+    // a transient value equals, and hashes as, the entry added after it
+    QhmEndpoint node = {"127.0.0.10", 5050, "interned_service"};
+    NodeTag before = node.tag();
+    NodeTag known = Interned::intern("interned_service");
+    assert(Interned::table_size() == size + 1);
+    assert(before == known && std::hash<NodeTag>()(before) == std::hash<NodeTag>()(known));
+
+    // and once it is there, decoded values share its entry
+    auto decoded = parse_qhm_endpoint(serialize_qhm_endpoint(node));
+    assert(decoded.tag().interned() && &decoded.tag().str() == &known.str());
+    NodeTag copy = before;
+    assert(!copy.interned() && copy == known && copy.str() == "interned_service");
+    copy = known;
+    assert(copy.interned() && decoded.tag() != NodeTag("other_service"));
+    assert(NodeTag().empty() && NodeTag("") == NodeTag());
+
+    // interning a node swaps its names for the table entries, its wire form stays the same
+    auto wire = node.encoded();
+    node.intern();
+    assert(node.tag().interned() && node.endpoint().interned() && node.encoded() == wire);
+    return true;
+}
+
+int main() {
+    assert(compact_roundtrip_test());
+    assert(legacy_json_test());
+    assert(invalid_input_test());
+    assert(interned_test());
+    return 0;
+}
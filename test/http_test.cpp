@@ -172,9 +172,61 @@ void test_offending(){
 }
 
 
+void peek_test(){
+    const std::string request = "GET /api/v1/get_time HTTP/1.1\n"
+                                "application-src: AQR/AAAK\n"
+                                "Application-Procid:  0123abcd \r\n"
+                                "content-length: 2\n"
+                                "\r\n"
+                                "application-dst: in the body";
+    const std::string response = "HTTP/1.1 200 OK\napplication-procid: 0123abcd\n\n";
+
+    std::string value;
+    assert(http::peek_request(request.data(), request.size()));
+    assert(!http::peek_request(response.data(), response.size()));
+    assert(http::peek_header(request.data(), request.size(), "application-src", &value));
+    assert(value == "AQR/AAAK");
+    assert(http::peek_header(request.data(), request.size(), "application-procid", &value));
+    assert(value == "0123abcd");
+    assert(!http::peek_header(request.data(), request.size(), "application-dst", &value));
+    assert(!http::peek_header(request.data(), request.size(), "application", &value));
+    assert(http::peek_header(response.data(), response.size(), "application-procid", &value));
+}
+
+void pool_test(){
+    auto message = message_from_type({"127.0.0.1", 5050, "pool"}, "/api/v1/get_time", 0, "REQUEST BODY");
+    const std::string request = message.str();
+
+    // a freed message is the next one handed out on this thread, emptied but with its buffers
+    auto first = http::new_request();
+    assert(http::parse_request(request.data(), request.size(), first));
+    assert(first->path == "/api/v1/get_time" && first->body == "REQUEST BODY" && first->headers.size() == 3);
+    auto capacity = first->body.capacity();
+    http::http_free(first);
+
+    auto second = http::new_request();
+    assert(second == first);
+    assert(second->headers.empty() && second->body.empty() && second->path.empty() && !second->success);
+    assert(second->body.capacity() == capacity);
+    assert(http::parse_request(request.data(), request.size(), second));
+    assert(second->headers.at("application-src") == serialize_qhm_endpoint({"127.0.0.1", 5050, "pool"}));
+    assert(second->body == "REQUEST BODY");
+    http::http_free(second);
+
+    // requests and responses are pooled apart
+    auto response = http::new_response();
+    assert((http::Message*) response != (http::Message*) first);
+    assert(response->status == 0 && response->headers.empty());
+    assert(!http::parse_response(request.data(), request.size(), response));
+    http::http_free(response);
+    http::http_free(nullptr);
+}
+
 int main(){
     url_test();
     http_test();
     test_offending();
+    peek_test();
+    pool_test();
     return 0;
 }
\ No newline at end of file
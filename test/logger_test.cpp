@@ -0,0 +1,144 @@
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// whatever the build picked, this test wants trace and debug compiled out
+#undef CORE_LOG_LEVEL
+#define CORE_LOG_LEVEL CORE_LOG_LEVEL_INFO
+#include "core/logger.h"
+
+static const char* LOG_PATH = "/tmp/qhm_logger_test.log";
+
+static size_t count_lines(const std::string& marker) {
+    std::ifstream in(LOG_PATH);
+    std::string line;
+    size_t n = 0;
+    while (std::getline(in, line)) if (line.find(marker) != std::string::npos) n++;
+    return n;
+}
+
+bool time_string_test() {
+    std::string a = time_string();
+    assert(a.size() == 18 && a[2] == '/' && a[5] == ' ' && a[14] == '.');
+    // the cached milliseconds keep moving
+    usleep(5000);
+    assert(time_string() != a);
+    return true;
+}
+
+bool many_writers_test() {
+    unlink(LOG_PATH);
+    assert(log_to_file(LOG_PATH));
+    auto dropped = log_dropped();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+        threads.emplace_back([t]() { for (int i = 0; i < 1000; i++) core_log_tag("writer") << "thread " << t << " line " << i; });
+    for (auto &t: threads) t.join();
+    log_flush();
+
+    // every line is either out, whole, or counted as dropped
+    assert(count_lines("[writer] ") + (log_dropped() - dropped) == 8000);
+    return true;
+}
+
+bool overflow_test() {
+    unlink(LOG_PATH);
+    assert(log_to_file(LOG_PATH));
+    auto dropped = log_dropped();
+
+    // far more than a ring holds, faster than a file takes it
+    std::string payload(4096, 'x');
+    c_time_t started = time_now();
+    for (int i = 0; i < 20000; i++) core_log_tag("burst") << payload;
+    c_time_t elapsed = time_now() - started;
+    log_flush();
+
+    auto lost = log_dropped() - dropped;
+    assert(count_lines("[burst] ") + lost == 20000);
+    if (lost) assert(count_lines("lines dropped") > 0);
+    assert(log_to_file(""));
+    core_log << "20000 lines of 4k in " << elapsed / 1000 << " ms, " << lost << " dropped";
+    unlink(LOG_PATH);
+    return true;
+}
+
+bool wake_test() {
+    unlink(LOG_PATH);
+    assert(log_to_file(LOG_PATH));
+
+    // the writer sleeps while there is nothing to write, and is woken by the line that ends that
+    usleep(100000);
+    core_log_tag("wake") << "first line after a pause";
+    for (int i = 0; i < 100 && !count_lines("[wake] "); i++) usleep(1000);
+    assert(count_lines("[wake] ") == 1);
+    assert(log_to_file(""));
+    unlink(LOG_PATH);
+    return true;
+}
+
+bool abort_test() {
+    unlink(LOG_PATH);
+    assert(log_to_file(LOG_PATH));
+    log_flush();
+    usleep(10000);
+
+    // the child has no writer thread: whatever reaches the file was drained on the way down
+    pid_t child = fork();
+    if (child == 0) {
+        for (int i = 0; i < 200; i++) core_err_tag("dying") << "line " << i;
+        abort();
+    }
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    assert(count_lines("[dying] ") == 200);
+    assert(log_to_file(""));
+    unlink(LOG_PATH);
+    return true;
+}
+
+bool level_test() {
+    int built = 0;
+    auto expensive = [&built]() { built++; return std::string("dump"); };
+    core_trace << expensive();
+    core_debug_tag("test") << expensive();
+    assert(built == 0);
+    core_log_tag("test") << expensive();
+    assert(built == 1);
+
+    // an else after a compiled out statement still belongs to the caller's if
+    bool taken = false;
+    if (built == 0) core_debug << "not here";
+    else taken = true;
+    assert(taken);
+    return true;
+}
+
+bool sampler_test() {
+    LogSampler every_third(3), never(0), always;
+    int sampled = 0, none = 0, all = 0;
+    for (int i = 0; i < 30; i++) {
+        sampled += every_third.sample();
+        none += never.sample();
+        all += always.sample();
+    }
+    assert(sampled == 10 && none == 0 && all == 30);
+    return true;
+}
+
+int main() {
+    assert(level_test());
+    assert(sampler_test());
+    assert(time_string_test());
+    assert(many_writers_test());
+    assert(overflow_test());
+    assert(wake_test());
+    assert(abort_test());
+    return 0;
+}
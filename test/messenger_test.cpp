@@ -6,6 +6,7 @@
 #include <thread>
 #include <zconf.h>
 #include <cmath>
+#include <set>
 #include "utils/tutorial_time_service.h"
 #include "utils/test_utils.h"
 #include "utils/tutorial_relay_service.h"
@@ -87,7 +88,7 @@ bool tutorial_test(){
     auto resp = sync_send_request(&advertisement, client1_node, relay_service_node);
     assert(resp.status == HTTP_STATUS_CREATED);
 
-    nlohmann::json body; body["callbackReference"] = time_service_node.endpoint + "/api/v1/get_time";
+    nlohmann::json body; body["callbackReference"] = time_service_node.endpoint() + "/api/v1/get_time";
 
     http::Request request;
     request.path = "/api/v1/sync_relay/imsi-23592000001?key1=val1&key2=val2";
@@ -111,12 +112,128 @@ bool tutorial_test(){
     return ret;
 }
 
+bool trace_test(){
+    Configuration tracing { {CONFIG_KEY_TRACE, "true"} };
+    std::thread t_service([&]() {
+        Configuration parameters(tracing);
+        parameters.incorporate(time_service_configuration);
+        TimeService a(parameters);
+        a.run();
+    });
+    std::thread r_service([&]() {
+        Configuration parameters(tracing);
+        parameters.incorporate(relay_service_configuration);
+        RelayService a(parameters);
+        a.run();
+    });
+    usleep(500000);
+
+    http::Request advertisement;
+    advertisement.path = "/advertise";
+    advertisement.method = HTTP_PUT;
+    advertisement.body = serialize_qhm_endpoint(time_service_node);
+    assert(sync_send_request(&advertisement, client1_node, relay_service_node).status == HTTP_STATUS_CREATED);
+
+    nlohmann::json body; body["callbackReference"] = time_service_node.endpoint() + "/api/v1/get_time";
+    http::Request request;
+    request.path = "/api/v1/sync_relay/imsi-23592000001";
+    request.method = HTTP_GET;
+    request.body = body.dump();
+    trace::clear();
+    std::string trace_id;
+    {
+        trace::Span client("client");
+        trace_id = trace::header().substr(0, 16);
+        assert(sync_send_request(&request, client1_node, relay_service_node).status == HTTP_STATUS_OK);
+    }
 
+    request.path = "/trace";
+    request.body.clear();
+    std::map<std::string, nlohmann::json> spans;
+    std::map<int, std::string> threads;
+    std::set<std::string> services;
+    // the relay closes its transaction span after replying: poll until both hops are exported
+    for (auto deadline = time_now() + 2000000; services.size() < 2 && time_now() < deadline; usleep(10000)) {
+        auto response = sync_send_request(&request, client1_node, time_service_node);
+        assert(response.status == HTTP_STATUS_OK);
+        auto trace = nlohmann::json::parse(response.body);
+
+        // client -> relay -> time service is one trace, each hop a child of the send that caused it
+        spans.clear();
+        threads.clear();
+        services.clear();
+        for (auto&& e: trace["traceEvents"]) {
+            if (e["ph"] == "M") threads[e["tid"].get<int>()] = e["args"]["name"];
+            if (e["ph"] == "X" && e["args"]["trace"] == trace_id) spans[e["args"]["span"].get<std::string>()] = e;
+        }
+        for (auto&& span: spans) {
+            if (span.second["name"] != "transaction") continue;
+            auto parent = spans.find(span.second["args"]["parent"].get<std::string>());
+            assert(parent != spans.end() && parent->second["name"] == "send_request");
+            services.insert(threads[span.second["tid"].get<int>()]);
+        }
+    }
+    assert(services.count("relay_service") && services.count("time_service"));
+    // the export is bounded to the most recent spans asked for
+    request.path = "/trace?limit=3";
+    auto limited = nlohmann::json::parse(sync_send_request(&request, client1_node, time_service_node).body);
+    size_t limited_spans = 0;
+    for (auto&& e: limited["traceEvents"]) if (e["ph"] == "X") limited_spans++;
+    assert(limited_spans == 3);
+    for (auto stage: {"parse_http", "route", "handler", "serialize", "parse_qhm_endpoint", "transaction_commit",
+                      "exchange", "parse_response"}) {
+        bool seen = false;
+        for (auto&& span: spans) seen |= span.second["name"] == stage;
+        assert(seen);
+    }
+    trace::enable(false);
+
+    kill_node(relay_service_node);
+    kill_node(time_service_node);
+    r_service.join();
+    t_service.join();
+    return true;
+}
+
+bool event_test(){
+    // no parameters, no allocation: an event is its type, its name and an empty pointer
+    assert(sizeof(Event) <= 3 * sizeof(void*));
+    Event terminate(SERVICE_TERMINATE);
+    assert(terminate.type == SERVICE_TERMINATE && terminate.name() == "SERVICE_TERMINATE");
+    assert(!terminate.has_params() && static_cast<const Event&>(terminate).params().empty());
+    assert(!terminate.has_params());
+
+    Event high_mark((EventType) 20001, "high_mark");
+    high_mark.params()["count"] = 3;
+    std::queue<Event> queue;
+    queue.push(std::move(high_mark));
+    assert(!high_mark.has_params());
+    const Event out = std::move(queue.front());
+    queue.pop();
+    assert(out.type == 20001 && out.name() == "high_mark" && out.params()["count"] == 3);
+    return true;
+}
+
+bool known_nodes_test(){
+    MessengerContext ctx;
+    ctx.node_self = &client1_node;
+    assert(add_node(&ctx, time_service_node));
+    assert(ctx.known_nodes.count(time_service_node.tag()));
+
+    // the node goes with its entry, and only once
+    assert(del_node(&ctx, time_service_node) == CORE_OK);
+    assert(ctx.known_nodes.empty());
+    assert(del_node(&ctx, time_service_node) == CORE_GENERIC_ERROR);
+    return true;
+}
 
 int main() {
 
+    do_test(event_test());
     do_test(apitree_test());
     do_test(tutorial_test());
+    do_test(known_nodes_test());
+    do_test(trace_test());
 
     // you need a large number to get a correct estimate (overhead weighs less), keeping the number low to make tests faster
 //    int num = 100000;
@@ -199,9 +316,9 @@ bool benchmark(int num, int threads) {
         auto api_msg = __api_msg("time_service/api/v1/ping", node);
 
         client_fixture client(node);
-        client.set_send_endpoint(time_service_node.endpoint);
+        client.set_send_endpoint(time_service_node.endpoint());
         client.known_nodes["time_service"] = time_service_node;
-        client.set_send_endpoint(time_service_node.endpoint);
+        client.set_send_endpoint(time_service_node.endpoint());
         usleep(10000);
 
         int ok(0);
@@ -0,0 +1,88 @@
+#include <cassert>
+#include <thread>
+#include <vector>
+#include "core/logger.h"
+#include "core/metrics.h"
+
+bool counter_test() {
+    auto counter = metrics::registry().counter("test_events_total", metrics::labels({{"kind", "a"}}));
+    assert(counter == metrics::registry().counter("test_events_total", metrics::labels({{"kind", "a"}})));
+
+    // every thread writes its own slot, the read merges them
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+        threads.emplace_back([counter]() { for (int i = 0; i < 100000; i++) counter->inc(); });
+    for (auto &t: threads) t.join();
+    assert(counter->value() == 800000);
+
+    auto gauge = metrics::registry().gauge("test_depth");
+    gauge->set(5);
+    gauge->add(-2);
+    assert(gauge->value() == 3);
+    return true;
+}
+
+bool histogram_test() {
+    // buckets are contiguous and each value lies below the upper bound of its own
+    for (int64_t v = 0; v < 100000; v++) {
+        auto b = metrics::Histogram::bucket(v);
+        assert(v < metrics::Histogram::bucket_upper_bound(b));
+        assert(b == 0 || v >= metrics::Histogram::bucket_upper_bound(b - 1));
+    }
+    assert(metrics::Histogram::bucket(INT64_MAX) == metrics::HISTOGRAM_BUCKETS - 1);
+
+    auto histogram = metrics::registry().histogram("test_latency_microseconds");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([histogram]() { for (int v = 1; v <= 10000; v++) histogram->record(v); });
+    for (auto &t: threads) t.join();
+
+    auto snap = histogram->snapshot();
+    assert(snap.count == 40000);
+    assert(snap.sum == 4 * 10000LL * 10001 / 2);
+    // within the bucket resolution, 1/16th
+    auto p50 = snap.percentile(0.5), p99 = snap.percentile(0.99);
+    assert(p50 >= 5000 && p50 <= 5000 * 17 / 16 + 1);
+    assert(p99 >= 9900 && p99 <= 9900 * 17 / 16 + 1);
+
+    c_time_t started = time_now();
+    for (int i = 0; i < 1000000; i++) histogram->record(i & 1023);
+    core_log << "histogram record: " << (time_now() - started) / 1000.0 << " ns";
+    return true;
+}
+
+bool prometheus_test() {
+    metrics::registry().counter("test_exposed_total", metrics::labels({{"route", "/a\"b"}}))->inc(3);
+    metrics::registry().histogram("test_exposed_microseconds")->record(100);
+    auto text = metrics::registry().prometheus();
+    core_log << text;
+    assert(text.find("# TYPE test_exposed_total counter\n") != std::string::npos);
+    assert(text.find("test_exposed_total{route=\"/a\\\"b\"} 3\n") != std::string::npos);
+    assert(text.find("# TYPE test_exposed_microseconds histogram\n") != std::string::npos);
+    assert(text.find("test_exposed_microseconds_bucket{le=\"+Inf\"} 1\n") != std::string::npos);
+    // inclusive bounds, the same set whatever was recorded
+    assert(text.find("test_exposed_microseconds_bucket{le=\"63\"} 0\n") != std::string::npos);
+    assert(text.find("test_exposed_microseconds_bucket{le=\"127\"} 1\n") != std::string::npos);
+    metrics::registry().histogram("test_exposed_microseconds")->record(127);
+    metrics::registry().histogram("test_exposed_microseconds")->record(128);
+    metrics::registry().histogram("test_exposed_microseconds")->record(1 << 20);
+    auto again = metrics::registry().prometheus();
+    assert(again.find("test_exposed_microseconds_bucket{le=\"127\"} 2\n") != std::string::npos);
+    auto buckets = [](const std::string& text) {
+        size_t n = 0;
+        for (size_t at = text.find("test_exposed_microseconds_bucket"); at != std::string::npos;
+             at = text.find("test_exposed_microseconds_bucket", at + 1)) n++;
+        return n;
+    };
+    assert(buckets(text) == buckets(again));
+    assert(buckets(text) == metrics::HISTOGRAM_BUCKETS >> metrics::HISTOGRAM_SUB_BITS);
+    assert(text.find("test_exposed_microseconds_count 1\n") != std::string::npos);
+    return true;
+}
+
+int main() {
+    assert(counter_test());
+    assert(histogram_test());
+    assert(prometheus_test());
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <cassert>
+#include <cmath>
+#include <thread>
+#include "core/perf.h"
+
+static volatile double sink;
+
+static void busy(int n) {
+    double x = 0;
+    for (int i = 1; i < n; i++) x += std::sqrt((double) i);
+    sink = x;
+}
+
+static size_t count_of(const std::string& report, const std::string& needle) {
+    size_t n = 0;
+    for (auto at = report.find(needle); at != std::string::npos; at = report.find(needle, at + 1)) n++;
+    return n;
+}
+
+bool disabled_test() {
+    perf::clear();
+    { perf::Stage stage("ignored"); busy(1000); }
+    perf::commit("/route");
+    assert(perf::report().find("ignored") == std::string::npos);
+    return true;
+}
+
+bool stages_test() {
+    if (!perf::enable(true)) {
+        // no counter at all on this machine: the report says so instead of showing zeros
+        assert(perf::report().find("no performance counter available") != std::string::npos);
+        perf::enable(false);
+        return true;
+    }
+    assert(perf::available(perf::TASK_CLOCK));
+    perf::clear();
+
+    perf::Reading before, after;
+    assert(perf::read(&before) && before.valid);
+    busy(200000);
+    assert(perf::read(&after) && after.value[perf::TASK_CLOCK] > before.value[perf::TASK_CLOCK]);
+
+    // stages are filed under the label of the commit that follows them
+    for (int i = 0; i < 3; i++) {
+        { perf::Stage stage("parse"); busy(20000); }
+        { perf::Stage stage("handler"); busy(50000); }
+        perf::commit("/api/v1/a");
+    }
+    { perf::Stage stage("handler"); busy(50000); }
+    perf::commit("/api/v1/b");
+    perf::commit("/api/v1/c");      // nothing measured since the last commit
+
+    // and so are those of the other threads
+    std::thread other([]() {
+        { perf::Stage stage("parse"); busy(20000); }
+        perf::commit("/api/v1/b");
+    });
+    other.join();
+
+    auto report = perf::report();
+    assert(count_of(report, "/api/v1/a") == 2);
+    assert(count_of(report, "/api/v1/b") == 2);
+    assert(count_of(report, "/api/v1/c") == 0);
+    assert(report.find("task_clock_ns/op") != std::string::npos);
+
+    perf::clear();
+    assert(perf::report().find("/api/v1/a") == std::string::npos);
+    perf::enable(false);
+    return true;
+}
+
+int main() {
+    assert(disabled_test());
+    assert(stages_test());
+    return 0;
+}
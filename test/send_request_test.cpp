@@ -3,8 +3,12 @@
 //
 
 #include <thread>
+#include <atomic>
+#include <set>
+#include <csignal>
 #include <zconf.h>
 #include "messenger/messenger.h"
+#include "load/load.h"
 #include "utils/tutorial_time_service.h"
 #include "utils/test_utils.h"
 
@@ -20,22 +24,29 @@ Configuration client_configuration = {
         {CONFIG_KEY_TAG,        "client_node"}
 };
 
+Configuration replica_configuration = {
+        {CONFIG_KEY_SELF_IP,    "127.0.0.12"},
+        {CONFIG_KEY_PORT,       std::to_string(QHM_DEFAULT_SERVICE_PORT)},
+        {CONFIG_KEY_TAG,        "time_service"}
+};
 
+auto time_service_node = qhm_endpoint_from_configuration(time_service_configuration);
+auto replica_node = qhm_endpoint_from_configuration(replica_configuration);
+auto client_node = qhm_endpoint_from_configuration(client_configuration);
 
-int main(){
-
-    std::thread service ([](){
-        Configuration  p;
-        p["verbose"] = "true";
-        p.incorporate(time_service_configuration);
-        TimeService timeService(p);
-        timeService.run();
-    });
+static void run_time_service(const Configuration& extra = Configuration()){
+    Configuration  p;
+    p["verbose"] = "true";
+    p.incorporate(time_service_configuration);
+    p.incorporate(extra);
+    TimeService timeService(p);
+    timeService.run();
+}
 
-    usleep(1000);
+bool send_request_test(){
+    std::thread service([](){ run_time_service(); });
 
-    auto time_service_node = qhm_endpoint_from_configuration(time_service_configuration);
-    auto client_node = qhm_endpoint_from_configuration(client_configuration);
+    usleep(100000);
 
     http::Request request;
     request.path = "/api/v1/get_time";
@@ -51,6 +62,681 @@ int main(){
     kill_node(time_service_node);
 
     service.join();
+    return true;
+}
+
+bool reliable_request_test(){
+    RequestOptions reliable;
+    reliable.reliable = true;
+
+    // the service comes up after the first transmissions are lost, retransmissions get through
+    std::thread service([](){ usleep(200000); run_time_service(); });
+
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    http::Response response = sync_send_request(&request, client_node, time_service_node, 3000, reliable);
+    assert(response.status == HTTP_STATUS_OK);
+    assert(headers_have(response.headers, HEADER_KEY_PROCEDURE_ID));
+    assert(response.headers.at(HEADER_KEY_PROCEDURE_ID) == request.headers.at(HEADER_KEY_PROCEDURE_ID));
+
+    // a request replayed with the same procedure id is answered without running the handler again
+    request.headers.erase(HEADER_KEY_PROCEDURE_ID);
+    auto first = sync_send_request(&request, client_node, time_service_node, 3000, reliable);
+    auto src = request.headers.at(HEADER_KEY_SERVICE_SRC);
+
+    QhmSockets::Socket replay_socket;
+    auto src_node = parse_qhm_endpoint(src);
+    replay_socket.bind(src_node.endpoint());
+    QhmSockets::SockAddr service_address;
+    assert(QhmSockets::resolve_endpoint(time_service_node.endpoint(), &service_address));
+    QhmSockets::Message(http::serialize(&request)).send_to(replay_socket, service_address);
+    QhmSockets::Message in;
+    assert(in.recv(replay_socket, 3000));
+    auto replayed = http::parse_response(in.data(), in.size());
+    assert(replayed.status == HTTP_STATUS_OK);
+    assert(replayed.headers.at("count") == first.headers.at("count"));
+    assert(replayed.body == first.body);
+    // and counted as a transaction of its own
+    auto replays = metrics::registry().counter("qhm_transactions_total",
+                                               metrics::labels({{"service", "time_service"}, {"route", "replayed"}}));
+    for(int i = 0; i < 100 && replays->value() != 1; i++) usleep(1000);
+    assert(replays->value() == 1);
+
+    // a fresh procedure id runs the handler
+    request.headers.erase(HEADER_KEY_PROCEDURE_ID);
+    auto second = sync_send_request(&request, client_node, time_service_node, 3000, reliable);
+    assert(second.headers.at("count") != first.headers.at("count"));
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool retransmit_deadline_test(){
+    // a peer that never answers: every retransmission it sees carries what is left of the budget, not all of it
+    QhmEndpoint silent("127.0.0.17", QHM_DEFAULT_SERVICE_PORT, "silent_service");
+    QhmSockets::Socket silent_socket;
+    silent_socket.bind(silent.endpoint());
+    assert(silent_socket.is_bound());
+
+    RequestOptions reliable;
+    reliable.reliable = true;
+    std::thread caller([&silent, &reliable](){
+        http::Request request;
+        request.path = "/api/v1/get_time";
+        request.method = HTTP_GET;
+        assert(sync_send_request(&request, client_node, silent, 500, reliable).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    });
+
+    std::vector<std::pair<c_time_t, long>> seen;
+    QhmSockets::Message in;
+    while(in.recv(silent_socket, 600)) {
+        auto request = http::parse_request(in.data(), in.size());
+        seen.emplace_back(time_now(), std::stol(request.headers.at(HEADER_KEY_DEADLINE)));
+        in = QhmSockets::Message();
+    }
+    caller.join();
+
+    assert(seen.size() > 2 && seen.front().second == 500);
+    for(size_t i = 1; i < seen.size(); i++) {
+        assert(seen[i].second < seen[i - 1].second);
+        assert(seen[i].second <= 500 - (seen[i].first - seen.front().first) / 1000 + 2);
+    }
+    return true;
+}
+
+bool idempotency_expiry_test(){
+    std::thread service([](){ run_time_service({{CONFIG_KEY_IDEMPOTENCY_TTL, "100"}}); });
+    usleep(100000);
+
+    RequestOptions reliable;
+    reliable.reliable = true;
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    auto first = sync_send_request(&request, client_node, time_service_node, 3000, reliable);
+    assert(first.status == HTTP_STATUS_OK);
+
+    // same source, same procedure id, but the stored reply has expired: the handler runs again
+    usleep(200000);
+    auto src_node = parse_qhm_endpoint(request.headers.at(HEADER_KEY_SERVICE_SRC));
+    QhmSockets::Socket replay_socket;
+    replay_socket.bind(src_node.endpoint());
+    QhmSockets::SockAddr service_address;
+    assert(QhmSockets::resolve_endpoint(time_service_node.endpoint(), &service_address));
+    QhmSockets::Message(http::serialize(&request)).send_to(replay_socket, service_address);
+    QhmSockets::Message in;
+    assert(in.recv(replay_socket, 3000));
+    auto replayed = http::parse_response(in.data(), in.size());
+    assert(replayed.status == HTTP_STATUS_OK);
+    assert(replayed.headers.at("count") != first.headers.at("count"));
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool admission_test(){
+    std::thread service([](){ run_time_service({{CONFIG_KEY_ADMISSION_QUEUE_DEPTH, "2"}}); });
+    usleep(100000);
+
+    // keep the worker busy, meanwhile more requests pile up than the ingress queue admits
+    auto overload = [](const std::string& message_type, std::atomic<int>* ok, std::atomic<int>* shed) {
+        std::thread slow([](){
+            http::Request request;
+            request.path = "/api/v1/slow";
+            request.method = HTTP_GET;
+            assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+        });
+        usleep(50000);
+
+        std::vector<std::thread> clients;
+        for(int i = 0; i < 4; i++)
+            clients.emplace_back([i, &message_type, ok, shed](){
+                QhmEndpoint host("127.0.0.11", QHM_DEFAULT_SERVICE_PORT + 1 + i, "client_" + std::to_string(i));
+                http::Request request;
+                request.path = "/api/v1/get_time";
+                request.method = HTTP_GET;
+                if(!message_type.empty()) request.headers[HEADER_KEY_APP_MESSAGETYPE] = message_type;
+                auto response = sync_send_request(&request, host, time_service_node, 1000);
+                if(response.status == HTTP_STATUS_OK) (*ok)++;
+                if(response.status == HTTP_STATUS_SERVICE_UNAVAILABLE) {
+                    assert(headers_have(response.headers, HEADER_KEY_RETRY_AFTER));
+                    (*shed)++;
+                }
+            });
+        for(auto& c: clients) c.join();
+        slow.join();
+    };
+
+    std::atomic<int> ok(0), shed(0);
+    overload("", &ok, &shed);
+    assert(ok == 2);
+    assert(shed == 2);
+
+    // application message types are shed like any request, only the messenger's own control types are not
+    ok = shed = 0;
+    overload("42", &ok, &shed);
+    assert(shed == 2);
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool hedged_request_test(){
+    std::thread service([](){ run_time_service(); });
+    std::thread replica([](){ run_time_service(replica_configuration); });
+    usleep(100000);
+
+    // the primary is stuck in a slow handler, the duplicate sent to the replica answers first
+    std::thread slow([](){
+        http::Request request;
+        request.path = "/api/v1/slow";
+        request.method = HTTP_GET;
+        assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+    });
+    usleep(50000);
+
+    RequestOptions hedged;
+    hedged.hedge = &replica_node;
+    hedged.hedge_delay = 20;
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    auto started = time_now();
+    auto response = sync_send_request(&request, client_node, time_service_node, 3000, hedged);
+    assert(response.status == HTTP_STATUS_OK);
+    assert(parse_qhm_endpoint(response.headers.at(HEADER_KEY_SERVICE_SRC)).ip_address() == replica_node.ip_address());
+    assert(time_now() - started < 200000);
+
+    slow.join();
+    kill_node(time_service_node);
+    kill_node(replica_node);
+    service.join();
+    replica.join();
+    return true;
+}
+
+bool timeout_latency_test(){
+    std::thread service([](){ run_time_service(); });
+    usleep(100000);
+
+    // two replicas of one route, one of them gone: its timeouts count in the route's latency like any reply
+    QhmEndpoint live(time_service_node.ip_address(), time_service_node.port(), "latency_service");
+    QhmEndpoint gone("127.0.0.14", QHM_DEFAULT_SERVICE_PORT, "latency_service");
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    for(int i = 0; i < 12; i++)
+        assert(sync_send_request(&request, client_node, live, 1000).status == HTTP_STATUS_OK);
+    for(int i = 0; i < 4; i++)
+        assert(sync_send_request(&request, client_node, gone, 50).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    assert(route_latency_percentile("latency_service/api/v1/get_time", 0.5) < 50);
+    assert(route_latency_percentile("latency_service/api/v1/get_time", 0.95) >= 50);
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool ephemeral_peer_test(){
+    MessengerContext ctx;
+    ctx.node_self = &client_node;
+
+    // however many peers come and go, the cache stays within its capacity
+    for(int port = 10000; port < 10000 + (int) EPHEMERAL_PEER_CAPACITY + 100; port++)
+        assert(ephemeral_peer_address(&ctx, {"127.0.0.11", port, "temp_client"}));
+    assert(ctx.ephemeral_peers.size() == EPHEMERAL_PEER_CAPACITY);
+    assert(ctx.ephemeral_order.size() == EPHEMERAL_PEER_CAPACITY);
+    assert(!ctx.ephemeral_peers.count("127.0.0.11:10000"));
+    assert(ctx.ephemeral_peers.count("127.0.0.11:11123"));
+
+    // and those expired leave with the next peer cached
+    MessengerContext short_lived;
+    short_lived.node_self = &client_node;
+    short_lived.ephemeral_peer_ttl = 1000;
+    for(int port = 20000; port < 20010; port++)
+        assert(ephemeral_peer_address(&short_lived, {"127.0.0.11", port, "temp_client"}));
+    usleep(2000);
+    assert(ephemeral_peer_address(&short_lived, {"127.0.0.11", 20000, "temp_client"}));
+    assert(short_lived.ephemeral_peers.size() == 1 && short_lived.ephemeral_order.size() == 1);
+    return true;
+}
+
+bool service_group_test(){
+    MessengerContext ctx;
+    ctx.node_self = &client_node;
+    assert(add_node(&ctx, time_service_node));
+    assert(add_node(&ctx, replica_node, 3));
+    assert(!add_node(&ctx, replica_node));
+    assert(ctx.known_nodes.at("time_service").members.size() == 2);
+
+    // the less loaded replica wins
+    auto primary = ctx.known_nodes.at("time_service").find(time_service_node.endpoint());
+    auto replica = ctx.known_nodes.at("time_service").find(replica_node.endpoint());
+    primary->load_state->hint = 5;
+    primary->load_state->hint_expires = time_now() + 1000000;
+    for(int i = 0; i < 100; i++) assert(find_node_by_uri("time_service", &ctx.known_nodes, nullptr) == replica);
+
+    // with no load to tell them apart, the weights do
+    primary->load_state->hint_expires = 0;
+    int picked_replica = 0;
+    for(int i = 0; i < 1000; i++)
+        if(find_node_by_uri("time_service", &ctx.known_nodes, nullptr) == replica) picked_replica++;
+    assert(picked_replica > 650 && picked_replica < 850);
+
+    // over the whole group, not just a pair of its members: 6 of 8 shares, where a weighted coin between two
+    // random members would give it 4 of 7
+    auto heavy = add_node(&ctx, {"127.0.0.15", QHM_DEFAULT_SERVICE_PORT, "time_service"}, 6);
+    assert(heavy);
+    replica->weight = 1;
+    int picked_heavy = 0;
+    for(int i = 0; i < 1000; i++)
+        if(find_node_by_uri("time_service", &ctx.known_nodes, nullptr) == heavy) picked_heavy++;
+    assert(picked_heavy > 680 && picked_heavy < 820);
+    // and discounted by what they have not answered yet
+    heavy->load_state->outstanding = 5;
+    picked_heavy = 0;
+    for(int i = 0; i < 1000; i++)
+        if(find_node_by_uri("time_service", &ctx.known_nodes, nullptr) == heavy) picked_heavy++;
+    assert(picked_heavy > 250 && picked_heavy < 430);
+    heavy->load_state->outstanding = 0;
+
+    // an error goes back to the replica that asked, not to any of its tag
+    QhmSockets::Message error_reply;
+    for(int i = 0; i < 20; i++) {
+        assert(error(&ctx, &error_reply, replica_node, HTTP_STATUS_INTERNAL_SERVER_ERROR) == CORE_OK);
+        auto parsed = http::parse_response(error_reply.data(), error_reply.size());
+        assert(parse_qhm_endpoint(parsed.headers.at(HEADER_KEY_SERVICE_DST)).endpoint() == replica_node.endpoint());
+    }
+    assert(del_node(&ctx, *heavy) == CORE_OK);
+    replica->weight = 3;
+
+    // callers address the tag, both replicas get traffic and report their load
+    std::thread service([](){ run_time_service(); });
+    std::thread replica_service([](){ run_time_service(replica_configuration); });
+    usleep(100000);
+
+    std::set<std::string> answered_by;
+    for(int i = 0; i < 20; i++) {
+        http::Request request;
+        request.path = "/api/v1/get_time";
+        request.method = HTTP_GET;
+        auto response = sync_send_request(&ctx, &request, "time_service", 3000);
+        assert(response.status == HTTP_STATUS_OK);
+        assert(headers_have(response.headers, HEADER_KEY_LOAD));
+        answered_by.insert(parse_qhm_endpoint(response.headers.at(HEADER_KEY_SERVICE_SRC)).ip_address());
+    }
+    assert(answered_by.size() == 2);
+
+    // every request sent by tag counts until its reply, or its timeout, whether the caller waits for it or not
+    auto outstanding = [&](){ return primary->load_state->outstanding + replica->load_state->outstanding; };
+    std::vector<std::thread> callers;
+    for(int i = 0; i < 4; i++)
+        callers.emplace_back([&ctx](){
+            http::Request request;
+            request.path = "/api/v1/slow";
+            request.method = HTTP_GET;
+            assert(sync_send_request(&ctx, &request, "time_service", 3000).status == HTTP_STATUS_OK);
+        });
+    for(int i = 0; i < 4; i++) {
+        http::Request request;
+        request.path = "/api/v1/slow";
+        request.method = HTTP_GET;
+        async_send_request(&ctx, &request, "time_service", 3000);
+    }
+    usleep(100000);
+    assert(outstanding() == 8);
+    for(auto&& caller: callers) caller.join();
+    for(int i = 0; i < 300 && outstanding(); i++) usleep(10000);
+    assert(outstanding() == 0);
+
+    MessengerContext unanswered;
+    unanswered.node_self = &client_node;
+    auto gone = add_node(&unanswered, {"127.0.0.16", QHM_DEFAULT_SERVICE_PORT, "gone_service"});
+    assert(gone);
+    http::Request lost;
+    lost.path = "/api/v1/get_time";
+    lost.method = HTTP_GET;
+    async_send_request(&unanswered, &lost, "gone_service", 50);
+    assert(gone->load_state->outstanding == 1);
+    for(int i = 0; i < 100 && gone->load_state->outstanding; i++) usleep(10000);
+    assert(gone->load_state->outstanding == 0);
+
+    assert(del_node(&ctx, replica_node) == CORE_OK);
+    assert(ctx.known_nodes.at("time_service").members.size() == 1);
+    assert(del_node(&ctx, time_service_node) == CORE_OK);
+    assert(ctx.known_nodes.empty());
+
+    kill_node(time_service_node);
+    kill_node(replica_node);
+    service.join();
+    replica_service.join();
+    return true;
+}
+
+bool response_cache_test(){
+    std::thread service([](){ run_time_service(); });
+    usleep(100000);
+
+    auto get = [](const std::string& path){
+        http::Request request;
+        request.path = path;
+        request.method = HTTP_GET;
+        auto response = sync_send_request(&request, client_node, time_service_node, 3000);
+        assert(response.status == HTTP_STATUS_OK);
+        assert(headers_have(response.headers, HEADER_KEY_LOAD));
+        return response.headers.at("count");
+    };
+
+    // same path and zone, whatever else the query says: the handler ran once
+    auto first = get("/api/v1/cached_time?zone=utc");
+    assert(get("/api/v1/cached_time?other=1&zone=utc") == first);
+    // the zone is part of the key, the handler runs again
+    assert(get("/api/v1/cached_time?zone=cet") != first);
+    // an expired entry is refreshed
+    usleep(300000);
+    assert(get("/api/v1/cached_time?zone=utc") != first);
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool coalescing_test(){
+    std::thread service([](){ run_time_service(); });
+    usleep(100000);
+
+    RequestOptions coalesce;
+    coalesce.coalesce = true;
+    auto slow_requests = [&coalesce](const std::vector<std::string>& paths){
+        auto started = time_now();
+        std::vector<std::thread> callers;
+        for(auto&& path: paths)
+            callers.emplace_back([&coalesce, path](){
+                http::Request request;
+                request.path = path;
+                request.method = HTTP_GET;
+                auto response = sync_send_request(&request, client_node, time_service_node, 3000, coalesce);
+                assert(response.status == HTTP_STATUS_OK);
+            });
+        for(auto& c: callers) c.join();
+        return time_now() - started;
+    };
+
+    // five identical requests are handled once, two different ones twice (the service handles one at a time)
+    assert(slow_requests(std::vector<std::string>(5, "/api/v1/slow")) < 550000);
+    assert(slow_requests({"/api/v1/slow?a=1", "/api/v1/slow?a=2"}) >= 550000);
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool circuit_breaker_test(){
+    Configuration dead_configuration = {
+            {CONFIG_KEY_SELF_IP,    "127.0.0.13"},
+            {CONFIG_KEY_PORT,       std::to_string(QHM_DEFAULT_SERVICE_PORT)},
+            {CONFIG_KEY_TAG,        "time_service"}
+    };
+    auto dead_node = qhm_endpoint_from_configuration(dead_configuration);
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
 
+    // every timeout is paid in full until the breaker opens...
+    for(int i = 0; i < BREAKER_FAILURE_THRESHOLD; i++)
+        assert(sync_send_request(&request, client_node, dead_node, 100).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    assert(breaker_open(dead_node.endpoint()));
+    assert(!NeighbourNode(dead_node).connected());
+
+    // ...then requests fail fast
+    auto started = time_now();
+    assert(sync_send_request(&request, client_node, dead_node, 100).status == HTTP_STATUS_SERVICE_UNAVAILABLE);
+    assert(time_now() - started < 50000);
+
+    // a hedged probe answered by the other replica gives the probe back instead of wedging the breaker
+    std::thread replica([](){ run_time_service(replica_configuration); });
+    usleep(BREAKER_OPEN_MS * 1000);
+    RequestOptions hedged;
+    hedged.hedge = &replica_node;
+    hedged.hedge_delay = 20;
+    assert(sync_send_request(&request, client_node, dead_node, 1000, hedged).status == HTTP_STATUS_OK);
+    assert(sync_send_request(&request, client_node, dead_node, 100).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    assert(breaker_open(dead_node.endpoint()));
+    kill_node(replica_node);
+    replica.join();
+
+    // once the node is back, the half open breaker lets a probe through and closes
+    std::thread service([&dead_configuration](){ run_time_service(dead_configuration); });
+    usleep(BREAKER_OPEN_MS * 1000);
+    assert(sync_send_request(&request, client_node, dead_node, 3000).status == HTTP_STATUS_OK);
+    assert(!breaker_open(dead_node.endpoint()));
+    assert(NeighbourNode(dead_node).connected());
+
+    kill_node(dead_node);
+    service.join();
+    return true;
+}
+
+bool deadline_test(){
+    std::thread service([](){ run_time_service(); });
+    usleep(100000);
+
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    auto before = std::stoi(sync_send_request(&request, client_node, time_service_node, 3000).headers.at("count"));
+
+    // queued behind a slow request, this one is dropped when its turn comes: its caller gave up already
+    std::thread slow([](){
+        http::Request request;
+        request.path = "/api/v1/slow";
+        request.method = HTTP_GET;
+        assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+    });
+    usleep(50000);
+    assert(sync_send_request(&request, client_node, time_service_node, 100).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    slow.join();
+    auto after = std::stoi(sync_send_request(&request, client_node, time_service_node, 3000).headers.at("count"));
+    assert(after == before + 1);
+
+    // requests made on behalf of another one inherit what is left of its deadline
+    set_request_deadline(time_now() + 50000);
+    request.path = "/api/v1/slow";
+    auto started = time_now();
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    assert(time_now() - started < 200000);
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_REQUEST_TIMEOUT);
+    set_request_deadline(0);
+
+    usleep(300000);
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool metrics_route_test(){
+    std::thread service([](){ run_time_service(); });
+    usleep(100000);
+
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+    request.path = "/api/v1/gets_time";
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_NOT_FOUND);
+
+    request.path = "/metrics";
+    auto response = sync_send_request(&request, client_node, time_service_node, 3000);
+    assert(response.status == HTTP_STATUS_OK);
+    auto& text = response.body;
+    assert(text.find("qhm_transactions_total{service=\"time_service\",route=\"/api/v1/get_time\"}")
+           != std::string::npos);
+    assert(text.find("qhm_transactions_total{service=\"time_service\",route=\"unrouted\"}") != std::string::npos);
+    assert(text.find("qhm_transaction_latency_microseconds_count{service=\"time_service\"") != std::string::npos);
+    assert(text.find("qhm_ingress_queue_depth{service=\"time_service\"}") != std::string::npos);
+    assert(text.find("qhm_shed_total{service=\"time_service\"}") != std::string::npos);
+
+    kill_node(time_service_node);
+    service.join();
+    return true;
+}
+
+bool perf_route_test(){
+    std::thread service([](){ run_time_service({{CONFIG_KEY_PERF_COUNTERS, "true"}}); });
+    usleep(100000);
+
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+
+    // the stages of the transactions so far, under their route, when the machine has any counter
+    request.path = "/perf";
+    auto response = sync_send_request(&request, client_node, time_service_node, 3000);
+    assert(response.status == HTTP_STATUS_OK);
+    if (response.body.find("no performance counter available") == std::string::npos) {
+        assert(response.body.find("/api/v1/get_time") != std::string::npos);
+        assert(response.body.find("parse_http") != std::string::npos);
+        assert(response.body.find("handler") != std::string::npos);
+    }
+
+    kill_node(time_service_node);
+    service.join();
+    perf::enable(false);
+    return true;
+}
+
+bool capture_replay_test(){
+    const std::string capture = "/tmp/qhm_capture_test.pcap";
+    std::thread service([&](){ run_time_service({{CONFIG_KEY_CAPTURE_FILE, capture}}); });
+    usleep(100000);
+
+    http::Request request;
+    request.path = "/api/v1/get_time";
+    request.method = HTTP_GET;
+    for (int i = 0; i < 5; i++)
+        assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+
+    // what SIGUSR2 does: the worker dumps its recent datagrams once it is done waiting for the next one
+    raise(SIGUSR2);
+    usleep(100000);
+    assert(sync_send_request(&request, client_node, time_service_node, 3000).status == HTTP_STATUS_OK);
+
+    kill_node(time_service_node);
+    service.join();
+
+    QhmSockets::CaptureReader reader;
+    QhmSockets::CapturedDatagram datagram;
+    assert(reader.open(capture));
+    size_t captured = 0;
+    while (reader.next(&datagram)) {
+        if (captured++ == 0) {
+            auto parsed = http::parse_request(datagram.payload.data(), datagram.payload.size());
+            assert(parsed.success && parsed.path == "/api/v1/get_time");
+            assert(QhmSockets::address_string(datagram.source).find("127.0.0.11:") == 0);
+            assert(QhmSockets::same_address(datagram.destination, "127.0.0.10", QHM_DEFAULT_SERVICE_PORT));
+        }
+    }
+    assert(captured == 7);      // six requests and the termination
+
+    // a flight recorder file per dump request, the recent datagrams of the worker in it
+    bool dumped = false;
+    for (unsigned n = 1; n < 8 && !dumped; n++) {
+        auto path = std::string(FLIGHT_RECORDER_DIR) + "/time_service-" + std::to_string(getpid()) + "-"
+                    + std::to_string(n) + ".pcap";
+        if (!reader.open(path)) continue;
+        size_t recorded = 0;
+        while (reader.next(&datagram)) recorded++;
+        assert(recorded == 5 || recorded == 6);     // the sixth too, when the worker was waiting for it
+        unlink(path.c_str());
+        dumped = true;
+    }
+    assert(dumped);
+
+    // replayed against a fresh service, as fast as possible: the termination is not
+    service = std::thread([](){ run_time_service(); });
+    usleep(100000);
+    ReplayOptions options;
+    options.speed = 0;
+    options.reply_ip = client_node.ip_address();
+    auto result = replay_capture(capture, time_service_node.endpoint(), options);
+    assert(result.sent == 6 && result.skipped == 1 && result.replies == 6);
+
+    kill_node(time_service_node);
+    service.join();
+    unlink(capture.c_str());
+    return true;
+}
+
+static LoadResult _load_result(double offered, double throughput, int64_t p99) {
+    LoadResult r;
+    r.offered = offered;
+    r.elapsed = 1;
+    r.replies = (uint64_t) throughput;
+    metrics::Histogram latency;
+    for (int i = 0; i < 100; i++) latency.record(p99);
+    r.latency = latency.snapshot();
+    return r;
+}
+
+bool load_generator_test(){
+    std::thread service([](){ run_time_service({{"verbose", "false"}}); });
+    usleep(100000);
+
+    LoadOptions options;
+    options.target = time_service_node.endpoint();
+    options.path = "/api/v1/ping";
+    options.ip = client_node.ip_address();
+    options.rate = 1000;
+    options.duration = 0.5;
+    options.clients = 4;
+    options.threads = 2;
+    auto result = run_load(options);
+
+    // the schedule is kept whatever the replies do, each request is accounted for once
+    assert(result.sent == 500);
+    assert(result.replies + result.errors + result.timeouts == result.sent);
+    assert(result.replies >= result.sent * 9 / 10);
+    assert(result.latency.count == result.replies && result.service.count == result.replies);
+    assert(result.latency.percentile(0.5) <= result.latency.percentile(0.99));
+    assert(result.latency.percentile(0.99) <= result.latency.percentile(0.999));
+    // measured from when they were due, requests never look faster than from when they left
+    assert(result.latency.sum >= result.service.sum);
+    assert(result.max_latency >= result.max_service && result.max_service > 0);
+
+    kill_node(time_service_node);
+    service.join();
+
+    // keeping up means 95% of the offered rate answered, with a p99 within ten times the one at the lowest rate
+    assert(saturation_knee({}) == -1);
+    assert(saturation_knee({_load_result(1000, 1000, 200), _load_result(2000, 1990, 300),
+                            _load_result(4000, 3000, 400)}) == 1);
+    assert(saturation_knee({_load_result(1000, 1000, 200), _load_result(2000, 2000, 5000)}) == 0);
+    assert(saturation_knee({_load_result(1000, 500, 200)}) == -1);
+    return true;
+}
+
+int main(){
+    assert(send_request_test());
+    assert(reliable_request_test());
+    assert(retransmit_deadline_test());
+    assert(idempotency_expiry_test());
+    assert(admission_test());
+    assert(hedged_request_test());
+    assert(timeout_latency_test());
+    assert(ephemeral_peer_test());
+    assert(service_group_test());
+    assert(response_cache_test());
+    assert(coalescing_test());
+    assert(circuit_breaker_test());
+    assert(deadline_test());
+    assert(metrics_route_test());
+    assert(perf_route_test());
+    assert(capture_replay_test());
+    assert(load_generator_test());
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,102 @@
+#include <cassert>
+#include <thread>
+#include "json/single_include/nlohmann/json.hpp"
+#include "core/logger.h"
+#include "core/trace.h"
+
+static nlohmann::json spans_named(const nlohmann::json& trace, const std::string& name) {
+    nlohmann::json ret = nlohmann::json::array();
+    for (auto&& e: trace["traceEvents"]) if (e["ph"] == "X" && e["name"] == name) ret.push_back(e);
+    return ret;
+}
+
+bool disabled_test() {
+    trace::clear();
+    { trace::Span span("ignored"); assert(!trace::current().valid()); }
+    assert(spans_named(nlohmann::json::parse(trace::chrome_json()), "ignored").empty());
+    return true;
+}
+
+bool nesting_test() {
+    trace::enable(true);
+    trace::clear();
+    trace::Context outer_ctx;
+    {
+        trace::Span outer("outer");
+        outer_ctx = trace::current();
+        assert(outer_ctx.valid());
+        {
+            trace::Span inner("inner");
+            assert(trace::current().trace_id == outer_ctx.trace_id);
+            assert(trace::current().span_id != outer_ctx.span_id);
+        }
+        assert(trace::current().span_id == outer_ctx.span_id);
+
+        // what a request carries, picked up on another thread as a remote parent
+        auto header = trace::header();
+        assert(trace::parse(header).trace_id == outer_ctx.trace_id);
+        assert(!trace::parse("garbage").valid() && !trace::parse("12:zz").valid());
+        std::thread remote([header]() {
+            trace::name_thread("remote \"worker\"");
+            trace::Span served("served", trace::parse(header));
+        });
+        remote.join();
+    }
+    assert(!trace::current().valid());
+    trace::enable(false);
+
+    auto json = nlohmann::json::parse(trace::chrome_json());
+    auto outer = spans_named(json, "outer"), inner = spans_named(json, "inner"), served = spans_named(json, "served");
+    assert(outer.size() == 1 && inner.size() == 1 && served.size() == 1);
+    assert(inner[0]["args"]["parent"] == outer[0]["args"]["span"]);
+    assert(served[0]["args"]["parent"] == outer[0]["args"]["span"]);
+    assert(served[0]["args"]["trace"] == outer[0]["args"]["trace"]);
+    assert(served[0]["tid"] != outer[0]["tid"]);
+    assert(inner[0]["ts"].get<double>() >= outer[0]["ts"].get<double>());
+    assert(inner[0]["dur"].get<double>() <= outer[0]["dur"].get<double>());
+
+    // the hop to the other thread is drawn as a flow, and the thread has its name
+    int flows = 0, named = 0;
+    for (auto&& e: json["traceEvents"]) {
+        if (e["ph"] == "s" || e["ph"] == "f") flows++;
+        if (e["ph"] == "M" && e["args"]["name"] == "remote \"worker\"") named++;
+    }
+    assert(flows == 2 && named == 1);
+
+    trace::clear();
+    assert(spans_named(nlohmann::json::parse(trace::chrome_json()), "outer").empty());
+    return true;
+}
+
+bool overhead_test() {
+    trace::enable(true);
+    c_time_t started = time_now();
+    for (int i = 0; i < 100000; i++) trace::Span span("loop");
+    c_time_t elapsed = time_now() - started;
+    trace::enable(false);
+    core_log << "span open and close: " << elapsed / 100.0 << " ns";
+
+    // the ring keeps the latest spans only, less the slot that might have been mid write
+    auto json = nlohmann::json::parse(trace::chrome_json());
+    auto kept = spans_named(json, "loop").size();
+    assert(kept == trace::BUFFER_SPANS - 1);
+
+    // bounded exports keep the newest spans: by count, and by size whatever the count
+    auto newest = spans_named(nlohmann::json::parse(trace::chrome_json(10)), "loop");
+    assert(newest.size() == 10);
+    assert(newest.back()["args"]["span"] == spans_named(json, "loop").back()["args"]["span"]);
+    assert(json.dump().size() > 65507);
+    auto capped = trace::chrome_json(0, 60000);
+    assert(capped.size() <= 60000);
+    auto capped_spans = spans_named(nlohmann::json::parse(capped), "loop");
+    assert(!capped_spans.empty() && capped_spans.back()["args"]["span"] == newest.back()["args"]["span"]);
+    trace::clear();
+    return true;
+}
+
+int main() {
+    assert(disabled_test());
+    assert(nesting_test());
+    assert(overhead_test());
+    return 0;
+}
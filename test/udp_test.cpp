@@ -50,6 +50,8 @@ bool test3(){
         in.recv(insocket);
         core_ok << in.str() << " from " << in.sender_ip();
         assert(in.str() == "WOWZA");
+        // stamped by the kernel on arrival
+        assert(in.arrival_time() > 0 && in.arrival_time() <= time_now());
         in.recv(insocket);
         insocket.unbind("");
     });
@@ -70,9 +72,153 @@ bool test3(){
     return true;
 };
 
+bool large_datagram_test(){
+    using namespace QhmSockets;
+
+    // sockets carry no receive buffer of their own
+    assert(sizeof(Socket) < 1024);
+
+    Socket insocket;
+    insocket.bind("127.0.0.2:50502");
+    Socket outsocket;
+    SockAddr dst;
+    assert(resolve_endpoint("127.0.0.2:50502", &dst));
+
+    // one fitting the MTU buffer, one spilling into the large one, one filling both
+    std::string small(100, 's'), large, largest;
+    for (int i = 0; i < 20000; i++) large += (char) ('a' + i % 26);
+    for (int i = 0; i < BUFFER_LEN - 28 - 8; i++) largest += (char) ('A' + i % 26);
+    for (auto payload: {small, large, largest, small}) {
+        assert(outsocket.send_to(payload.data(), payload.size(), dst) == (int) payload.size());
+        Message in;
+        assert(in.recv(insocket, 1000) && in.str() == payload);
+    }
+    insocket.unbind("");
+    return true;
+}
+
+bool bind_test(){
+    using namespace QhmSockets;
+
+    Socket first;
+    first.bind("127.0.0.2:50502");
+    assert(first.is_bound());
+
+    // the address is taken: the second socket says so, and can try another one
+    Socket second;
+    second.bind("127.0.0.2:50502");
+    assert(!second.is_bound());
+    second.bind("127.0.0.2:50503");
+    assert(second.is_bound());
+    return true;
+}
+
+#include "udp/resolver.h"
+
+bool resolver_test(){
+    using namespace QhmSockets;
+    auto& cache = ResolverCache::instance();
+    cache.clear();
+
+    SockAddr addr;
+    auto before = cache.stats();
+    assert(resolve_endpoint("127.0.0.2:50501", &addr));
+    assert(same_address(addr, "127.0.0.2", 50501));
+    assert(resolve_endpoint("udp://[::1]:50501", &addr));
+    assert(same_address(addr, "::1", 50501));
+    assert(cache.stats().numeric == before.numeric + 2);
+    assert(cache.stats().lookups == before.lookups);
+
+    // names go to the resolver once, then come from the cache
+    assert(resolve_address("localhost", 50501, &addr));
+    assert(resolve_address("localhost", 50501, &addr));
+    assert(cache.stats().lookups == before.lookups + 1);
+    assert(cache.stats().hits == before.hits + 1);
+
+    // and so do failures
+    assert(!resolve_address("nonexistent.invalid", 50501, &addr));
+    assert(!resolve_address("nonexistent.invalid", 50501, &addr));
+    assert(cache.stats().lookups == before.lookups + 2);
+    assert(cache.stats().negative_hits == before.negative_hits + 1);
+
+    assert(!resolve_endpoint("no_port", &addr));
+
+    // the cache holds at most its capacity, failures included, the oldest going first
+    cache.clear();
+    cache.set_capacity(8);
+    for (int port = 50600; port < 50632; port++) {
+        resolve_address("localhost", port, &addr);
+        if (port % 8 == 0) resolve_address("nonexistent.invalid", port, &addr);
+        assert(cache.stats().entries <= 8);
+    }
+    assert(cache.stats().entries == 8);
+    auto lookups = cache.stats().lookups;
+    assert(resolve_address("localhost", 50631, &addr) && cache.stats().lookups == lookups);
+    assert(resolve_address("localhost", 50600, &addr) && cache.stats().lookups == lookups + 1);
+
+    // and those expired leave with the next name cached
+    cache.clear();
+    cache.set_ttl(1, 1);
+    for (int port = 50700; port < 50704; port++) resolve_address("localhost", port, &addr);
+    usleep(2000);
+    resolve_address("localhost", 50800, &addr);
+    assert(cache.stats().entries == 1);
+
+    cache.set_capacity(RESOLVER_CAPACITY);
+    cache.set_ttl(RESOLVER_POSITIVE_TTL_MS, RESOLVER_NEGATIVE_TTL_MS);
+    cache.clear();
+    return true;
+}
+
+#include "udp/capture.h"
+
+bool capture_test(){
+    using namespace QhmSockets;
+    const char* path = "/tmp/qhm_udp_capture_test.pcap";
+
+    CapturedDatagram v4, v6;
+    v4.time = 1700000000123456;
+    assert(resolve_endpoint("127.0.0.1:5050", &v4.source) && resolve_endpoint("127.0.0.2:40401", &v4.destination));
+    v4.payload = "GET /api HTTP/1.1\n\n";
+    v6.time = v4.time + 1500;
+    assert(resolve_endpoint("[::1]:6000", &v6.source) && resolve_endpoint("[::1]:40401", &v6.destination));
+    v6.payload = std::string("odd length \0 binary", 20);
+
+    CaptureWriter writer;
+    assert(writer.open(path));
+    writer.write(v4);
+    writer.write(v6);
+    writer.close();
+
+    CaptureReader reader;
+    assert(reader.open(path));
+    CapturedDatagram in;
+    for (auto expected: {&v4, &v6}) {
+        assert(reader.next(&in));
+        assert(in.time == expected->time && in.payload == expected->payload);
+        assert(address_string(in.source) == address_string(expected->source));
+        assert(address_string(in.destination) == address_string(expected->destination));
+    }
+    assert(!reader.next(&in));
+
+    // only the latest are kept, and dumped oldest first
+    FlightRecorder recorder(3);
+    for (int i = 0; i < 5; i++) recorder.record(Message(std::to_string(i)), v4.destination);
+    assert(recorder.size() == 3 && recorder.dump(path));
+    assert(reader.open(path));
+    for (int i = 2; i < 5; i++) assert(reader.next(&in) && in.payload == std::to_string(i));
+    assert(!reader.next(&in));
+    unlink(path);
+    return true;
+}
+
 int main() {
 //    assert(test1());
 //    assert(test2());
     assert(test3());
+    assert(bind_test());
+    assert(large_datagram_test());
+    assert(resolver_test());
+    assert(capture_test());
     return 0;
 }
\ No newline at end of file
@@ -30,7 +30,7 @@ struct client_fixture {
 
     client_fixture(const QhmEndpoint &in) : client_fixture() {
         self = in;
-        set_recv_endpoint(self.endpoint);
+        set_recv_endpoint(self.endpoint());
     }
 
     void set_send_endpoint(SockEndpoint e) {
@@ -87,7 +87,7 @@ struct client_fixture {
 
     void kill_remote(const QhmEndpoint &node) {
         auto msg = message_from_type(self, "/api", SERVICE_TERMINATE);
-        set_send_endpoint(node.endpoint);
+        set_send_endpoint(node.endpoint());
         send(&msg);
     }
 
@@ -96,12 +96,12 @@ struct client_fixture {
         std::string service_uri = path.front();
         std::string resource_path = url.substr(service_uri.length());
         auto msg = message_from_type(self, resource_path);
-        set_send_endpoint(known_nodes.at(service_uri).endpoint);
+        set_send_endpoint(known_nodes.at(service_uri).endpoint());
         send_and_recv(&msg);
     }
 
     void add_known_node(const QhmEndpoint &node) {
-        known_nodes[node.tag] = node;
+        known_nodes[node.tag()] = node;
     }
 
 
@@ -183,7 +183,8 @@ bool benchmark(int, int);
 
 static void kill_node(QhmEndpoint w){
 
-    NeighbourNode n(w);
+    QhmSockets::SockAddr dest;
+    core_assert(QhmSockets::resolve_endpoint(w.endpoint(), &dest), return);
     QhmSockets::Socket   recv_socket;
     recv_socket.setsockopt(RCVTIMEO, 300);
 
@@ -221,7 +222,7 @@ static void kill_node(QhmEndpoint w){
     QhmEndpoint src_node = {"", QHM_DEFAULT_REQUEST_PORT, uuid.pretty_print()};
 
     auto udpmsg = message_from_type(src_node, "/api", SERVICE_TERMINATE);
-    udpmsg.send(*n.socket);
+    udpmsg.send_to(recv_socket, dest);
 
 }
 
@@ -23,7 +23,6 @@ DECLARE_ROUTE_HANDLER(synchronous_relay_handler, in, out, params, ctx) {
 
     http::Request request;
     core_assert(ctx->known_nodes.find("time_service") != ctx->known_nodes.end(), return CORE_CONTINUE);
-    auto &&time_service = ctx->known_nodes.at("time_service");
 
     // if there are params for this route, append them in the get request
     std::string path = json_has_field(params["imsi"], "params") ?
@@ -43,7 +42,7 @@ DECLARE_ROUTE_HANDLER(synchronous_relay_handler, in, out, params, ctx) {
 
     subcontext->add_callback(addendum, subcontext->events[HIGH_MARK_EVT]);
 
-    auto response = sync_send_request(&request, *ctx->node_self, *time_service);
+    auto response = sync_send_request(ctx, &request, "time_service");
 
     (*out) = reply_back(in);
     auto resp_out = __as_response(*out);
@@ -55,8 +54,8 @@ DECLARE_ROUTE_HANDLER(synchronous_relay_handler, in, out, params, ctx) {
     core_try(count = std::stoi(response.headers["count"]), return CORE_OK;);
     if(count >= 1) {
         Event evt(subcontext->events.at(HIGH_MARK_EVT));
-        evt.params["count"] = count;
-        dispatch_event(ctx, evt);
+        evt.params()["count"] = count;
+        dispatch_event(ctx, std::move(evt));
     }
 
     return CORE_OK;
@@ -76,13 +75,13 @@ DECLARE_ROUTE_HANDLER(synchronous_relay_add_sign_handler, in, out, params, ctx)
 }
 
 DECLARE_ROUTE_HANDLER(advertise, in, out, params, ctx) {
-    (*out) = new http::Response();
+    (*out) = http::new_response();
     auto req = __as_request(in);
     auto resp = __as_response(*out);
     core_assert(req->type == http::REQUEST, resp->status = HTTP_STATUS_BAD_REQUEST; return CORE_OK;);
     core_assert(req->method == HTTP_PUT, resp->status = HTTP_STATUS_METHOD_NOT_ALLOWED; return CORE_OK;);
     auto newnode = parse_qhm_endpoint(req->body);
-    core_assert(!newnode.endpoint.empty(), resp->status = HTTP_STATUS_BAD_REQUEST; return CORE_OK;);
+    core_assert(!newnode.endpoint().empty(), resp->status = HTTP_STATUS_BAD_REQUEST; return CORE_OK;);
     add_node(ctx, newnode);
     resp->headers[HEADER_KEY_SERVICE_DST] = req->headers[HEADER_KEY_SERVICE_SRC];
     resp->status = HTTP_STATUS_CREATED;
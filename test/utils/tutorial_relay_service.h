@@ -33,7 +33,7 @@ struct RelayService_Context : public MessengerContext{
     Status                                          add_callback(std::shared_ptr<Callback> cb, EventType e) {
         QhmEndpoint endpoint = parse_url(cb->callback_uri);
         cb->destination = endpoint;
-        cb->nf_instance = endpoint.tag;
+        cb->nf_instance = endpoint.tag();
         cb->callback_path = parse_path(cb->callback_uri);
         callbacks[e].emplace_back(cb);
         return CORE_OK;
@@ -2,6 +2,7 @@
 // Created by Giulio Luzzati on 19/07/18.
 //
 
+#include <zconf.h>
 #include "tutorial_time_service.h"
 
 /* THIS is implemented by the developer ------------------------------------------------------------------------------*/
@@ -12,7 +13,7 @@ DECLARE_ROUTE_HANDLER(get_time_handler, in, out, params, ctx){
     (*out)->body = in->body + "\n";
     (*out)->body += "I've been asked this " + std::to_string(count) + " times - " +  time_string();
 
-    core_log_tag(ctx->node_self->tag) << "get_time_handler: request body is\n" << in->body << std::endl;
+    core_log_tag(ctx->node_self->tag()) << "get_time_handler: request body is\n" << in->body << std::endl;
 
     // if there are params, dump them in the body
     if(json_has_field(params["get_time"], "params")) (*out)->body += " " + params["get_time"]["params"].dump();
@@ -26,6 +27,21 @@ DECLARE_ROUTE_HANDLER(ping_handler, in, out, params, ctx){
     return CORE_OK;
 }
 
+DECLARE_ROUTE_HANDLER(cached_time_handler, in, out, params, ctx){
+    *out = reply_back(in);
+    (*out)->headers["count"] = std::to_string(((TimeServiceContext*)ctx)->count++);
+    (*out)->body = time_string();
+    __as_response(*out)->status = HTTP_STATUS_OK;
+    return CORE_OK;
+}
+
+DECLARE_ROUTE_HANDLER(slow_handler, in, out, params, ctx){
+    usleep(300000);
+    *out = reply_back(in);
+    __as_response(*out)->status = HTTP_STATUS_OK;
+    return CORE_OK;
+}
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 
 /* THIS will be autogenerated ----------------------------------------------------------------------------------------*/
@@ -33,6 +49,12 @@ Status TimeService::init() {
     context = std::make_shared<TimeServiceContext>(TimeServiceContext());
     context->router.add_route("/api/v1/get_time", &get_time_handler);
     context->router.add_route("/api/v1/ping", &ping_handler);
+    context->router.add_route("/api/v1/slow", &slow_handler);
+
+    RouteCachePolicy cached;
+    cached.ttl = 200000;
+    cached.query_params = {"zone"};
+    context->router.add_route("/api/v1/cached_time", &cached_time_handler, cached);
     return Messenger::init();
 }
 